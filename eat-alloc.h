@@ -0,0 +1,334 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+// The containers inside an image. EAT::offset_ptr is a pointer that keeps
+// working when the image is mapped at another address, and EAT::allocator
+// allocates the elements of a standard container from a master.
+
+#ifndef EYEBALL_ALLOCATION_TABLE_ALLOC
+#define EYEBALL_ALLOCATION_TABLE_ALLOC
+
+#include "eat.h"
+#include <new>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+
+namespace EAT
+{
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::offset_ptr<T> --- a self-relative pointer
+    //
+    // NOTE: It keeps the distance from itself to the target, so a pointer in
+    //       an image to the same image is valid wherever the image is, after
+    //       mapping it at another address or resize_master. A copy outside
+    //       the image (on the stack) is still a pointer of its own.
+    //       The blocks must not move within the image, so do not compact an
+    //       image that has containers. merge shifts all the blocks of the
+    //       source together; the pointers among them are kept.
+
+    template <typename T>
+    struct offset_ptr
+    {
+        // Types
+        typedef T                                       element_type;
+        typedef typename std::remove_cv<T>::type        value_type;
+        typedef std::ptrdiff_t                          difference_type;
+        typedef T *                                     pointer;
+        typedef typename std::add_lvalue_reference<T>::type reference;
+        typedef std::random_access_iterator_tag         iterator_category;
+        template <typename U>
+        using rebind = offset_ptr<U>;
+
+        offset_ptr() : m_diff(NULL_DIFF)
+        {
+        }
+        offset_ptr(std::nullptr_t) : m_diff(NULL_DIFF)
+        {
+        }
+        offset_ptr(T *ptr)
+        {
+            set(ptr);
+        }
+        offset_ptr(const offset_ptr& other)
+        {
+            set(other.get());
+        }
+        template <typename U, typename std::enable_if<std::is_convertible<U *, T *>::value, int>::type = 0>
+        offset_ptr(const offset_ptr<U>& other)
+        {
+            set(other.get());
+        }
+        // for static_cast
+        template <typename U, typename std::enable_if<!std::is_convertible<U *, T *>::value, int>::type = 0>
+        explicit offset_ptr(const offset_ptr<U>& other)
+        {
+            set(static_cast<T *>(other.get()));
+        }
+
+        offset_ptr& operator=(const offset_ptr& other)
+        {
+            set(other.get());
+            return *this;
+        }
+        offset_ptr& operator=(T *ptr)
+        {
+            set(ptr);
+            return *this;
+        }
+
+        T *get() const
+        {
+            if (m_diff == NULL_DIFF)
+                return NULL;
+            return reinterpret_cast<T *>(reinterpret_cast<std::intptr_t>(this) + m_diff);
+        }
+        explicit operator bool() const
+        {
+            return m_diff != NULL_DIFF;
+        }
+
+        reference operator*() const
+        {
+            return *get();
+        }
+        T *operator->() const
+        {
+            return get();
+        }
+        reference operator[](difference_type n) const
+        {
+            return get()[n];
+        }
+
+        // for std::pointer_traits
+        typedef typename std::conditional<std::is_void<T>::value, char, T>::type& ref_type;
+        static offset_ptr pointer_to(ref_type r)
+        {
+            return offset_ptr(std::addressof(r));
+        }
+
+        // arithmetic
+        offset_ptr& operator+=(difference_type n)
+        {
+            set(get() + n);
+            return *this;
+        }
+        offset_ptr& operator-=(difference_type n)
+        {
+            set(get() - n);
+            return *this;
+        }
+        offset_ptr& operator++()
+        {
+            return *this += 1;
+        }
+        offset_ptr& operator--()
+        {
+            return *this -= 1;
+        }
+        offset_ptr operator++(int)
+        {
+            offset_ptr ret(*this);
+            ++*this;
+            return ret;
+        }
+        offset_ptr operator--(int)
+        {
+            offset_ptr ret(*this);
+            --*this;
+            return ret;
+        }
+        friend offset_ptr operator+(const offset_ptr& p, difference_type n)
+        {
+            return offset_ptr(p.get() + n);
+        }
+        friend offset_ptr operator+(difference_type n, const offset_ptr& p)
+        {
+            return offset_ptr(p.get() + n);
+        }
+        friend offset_ptr operator-(const offset_ptr& p, difference_type n)
+        {
+            return offset_ptr(p.get() - n);
+        }
+        friend difference_type operator-(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() - b.get();
+        }
+
+        // comparison
+        friend bool operator==(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() == b.get();
+        }
+        friend bool operator!=(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() != b.get();
+        }
+        friend bool operator<(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() < b.get();
+        }
+        friend bool operator>(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() > b.get();
+        }
+        friend bool operator<=(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() <= b.get();
+        }
+        friend bool operator>=(const offset_ptr& a, const offset_ptr& b)
+        {
+            return a.get() >= b.get();
+        }
+        friend bool operator==(const offset_ptr& a, std::nullptr_t)
+        {
+            return !a;
+        }
+        friend bool operator!=(const offset_ptr& a, std::nullptr_t)
+        {
+            return !!a;
+        }
+        friend bool operator==(std::nullptr_t, const offset_ptr& a)
+        {
+            return !a;
+        }
+        friend bool operator!=(std::nullptr_t, const offset_ptr& a)
+        {
+            return !!a;
+        }
+
+    protected:
+        // zero is a pointer to itself, so NULL is 1 like a misaligned one
+        static const std::intptr_t NULL_DIFF = 1;
+        std::intptr_t m_diff;
+
+        void set(const volatile void *ptr)
+        {
+            if (!ptr)
+                m_diff = NULL_DIFF;
+            else
+                m_diff = reinterpret_cast<std::intptr_t>(ptr) - reinterpret_cast<std::intptr_t>(this);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::allocator<T, T_SIZE> --- allocates the elements from a master
+    //
+    // NOTE: The allocator keeps its master by an offset_ptr, so a container
+    //       built in the image (see EAT::construct) can be used in place
+    //       after mapping the image or resize_master. It throws
+    //       std::bad_alloc if the master is full, as the containers expect.
+    //       The container must keep its pointers as the pointer type of the
+    //       allocator, as std::vector does. libstdc++ keeps raw pointers in
+    //       std::basic_string and in the node based containers, so they
+    //       cannot be mapped at another address.
+    //       The master of a merged container is not shifted with it; read it,
+    //       but do not grow it in the merged image.
+
+    template <typename T, typename T_SIZE>
+    struct allocator
+    {
+        // Types
+        typedef T                           value_type;
+        typedef offset_ptr<T>               pointer;
+        typedef offset_ptr<const T>         const_pointer;
+        typedef offset_ptr<void>            void_pointer;
+        typedef offset_ptr<const void>      const_void_pointer;
+        typedef std::size_t                 size_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef MASTER<T_SIZE>              master_type;
+        template <typename U>
+        struct rebind
+        {
+            typedef allocator<U, T_SIZE> other;
+        };
+
+        allocator(master_type *master) : m_master(master)
+        {
+        }
+        allocator(const allocator& other) : m_master(other.master())
+        {
+        }
+        template <typename U>
+        allocator(const allocator<U, T_SIZE>& other) : m_master(other.master())
+        {
+        }
+        allocator& operator=(const allocator& other)
+        {
+            m_master = other.master();
+            return *this;
+        }
+
+        master_type *master() const
+        {
+            return m_master.get();
+        }
+
+        pointer allocate(size_type n)
+        {
+            if (n == 0)
+                return pointer();
+            if (n > size_type(T_SIZE(-1)) / sizeof(T))
+                throw std::bad_alloc();
+            void *ptr = master()->aligned_malloc_(T_SIZE(n * sizeof(T)), T_SIZE(alignof(T)));
+            if (!ptr)
+                throw std::bad_alloc();
+            return pointer(static_cast<T *>(ptr));
+        }
+        void deallocate(pointer p, size_type)
+        {
+            master()->free_(p.get());
+        }
+
+        template <typename U>
+        bool operator==(const allocator<U, T_SIZE>& other) const
+        {
+            return master() == other.master();
+        }
+        template <typename U>
+        bool operator!=(const allocator<U, T_SIZE>& other) const
+        {
+            return master() != other.master();
+        }
+
+    protected:
+        offset_ptr<master_type> m_master;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::construct<T>(master, args...)
+    // EAT::destroy(master, ptr)
+    //
+    // NOTE: construct builds an object in a block of the master, and returns
+    //       NULL if the master is full. Keep the offset (or a handle) of the
+    //       object to find it again after mapping the image.
+
+    template <typename T, typename T_SIZE, typename... T_ARGS>
+    inline T *construct(MASTER<T_SIZE> *master, T_ARGS&&... args)
+    {
+        void *ptr = master->aligned_malloc_(T_SIZE(sizeof(T)), T_SIZE(alignof(T)));
+        if (!ptr)
+            return NULL;
+        try
+        {
+            return new(ptr) T(std::forward<T_ARGS>(args)...);
+        }
+        catch (...)
+        {
+            master->free_(ptr);
+            throw;
+        }
+    }
+
+    template <typename T, typename T_SIZE>
+    inline void destroy(MASTER<T_SIZE> *master, T *ptr)
+    {
+        if (!ptr)
+            return;
+        ptr->~T();
+        master->free_(ptr);
+    }
+} // namespace EAT
+
+#endif  // ndef EYEBALL_ALLOCATION_TABLE_ALLOC
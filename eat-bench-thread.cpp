@@ -0,0 +1,88 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "eat.h"
+#include "eat-thread.h"
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+// run fn(k) on num_threads threads and return nanoseconds per operation
+template <typename T_FN>
+double run_threads(int num_threads, size_t num_ops, T_FN fn)
+{
+    std::vector<std::thread> threads;
+    auto start = clock_type::now();
+    for (int k = 0; k < num_threads; ++k)
+    {
+        threads.push_back(std::thread(fn, k));
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+    return double(ns) / double(num_ops);
+}
+
+// malloc_ from the threads: mutex-wrapped, lock-free and sub-masters
+void bench_threads(size_t ops_per_thread, uint32_t siz)
+{
+    printf("## malloc_(%u) from threads, ns/op\n", unsigned(siz));
+    printf("%8s %12s %12s %12s\n", "threads", "mutex", "concurrent", "local");
+    for (int num_threads = 1; num_threads <= 64; num_threads *= 2)
+    {
+        size_t num_ops = ops_per_thread * num_threads;
+        size_t total_size = 256 + num_ops * (siz + 3 * sizeof(uint32_t));
+        auto master = EAT::create_master<uint32_t>(total_size);
+        if (!master)
+        {
+            fprintf(stderr, "out of memory\n");
+            return;
+        }
+
+        std::mutex mutex;
+        double ns_mutex = run_threads(num_threads, num_ops, [&](int) {
+            for (size_t i = 0; i < ops_per_thread; ++i)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                master->malloc_(siz);
+            }
+        });
+
+        master->clear(false);
+        double ns_concurrent;
+        {
+            EAT::CONCURRENT<uint32_t> concurrent(master);
+            ns_concurrent = run_threads(num_threads, num_ops, [&](int) {
+                for (size_t i = 0; i < ops_per_thread; ++i)
+                {
+                    concurrent.malloc_(siz);
+                }
+            });
+        }
+        EAT::destroy_master(master);
+
+        EAT::SHARED<uint32_t> shared(total_size);
+        double ns_local = run_threads(num_threads, num_ops, [&](int) {
+            EAT::LOCAL<uint32_t> local(shared, 256 + ops_per_thread * (siz + 3 * sizeof(uint32_t)));
+            for (size_t i = 0; i < ops_per_thread; ++i)
+            {
+                local.malloc_(siz);
+            }
+            local.publish();
+        });
+
+        printf("%8d %12.2f %12.2f %12.2f\n", num_threads, ns_mutex, ns_concurrent, ns_local);
+    }
+}
+
+int main(void)
+{
+    bench_threads(100000, 16);
+    return 0;
+}
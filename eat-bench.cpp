@@ -0,0 +1,481 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "eat.h"
+#include "eat-thread.h"
+#include <chrono>
+#include <random>
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+typedef std::chrono::steady_clock clock_type;
+
+//////////////////////////////////////////////////////////////////////////////
+// the workload suite
+
+// forget the peak RSS so far, if the system can
+void reset_peak_rss()
+{
+#ifdef __linux__
+    if (FILE *fp = fopen("/proc/self/clear_refs", "w"))
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+// the peak RSS in KiB
+size_t peak_rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    #ifdef __linux__
+        if (FILE *fp = fopen("/proc/self/status", "r"))
+        {
+            char line[128];
+            size_t kb = 0;
+            while (fgets(line, sizeof(line), fp))
+            {
+                if (sscanf(line, "VmHWM: %zu", &kb) == 1)
+                    break;
+            }
+            fclose(fp);
+            if (kb)
+                return kb;
+        }
+    #endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #ifdef __APPLE__
+        return size_t(usage.ru_maxrss) / 1024; // in bytes
+    #else
+        return size_t(usage.ru_maxrss);
+    #endif
+#endif
+}
+
+double elapsed_ns(clock_type::time_point start, clock_type::time_point end)
+{
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// the cost of reading the clock, taken out of the samples
+double clock_overhead_ns()
+{
+    static double overhead = -1;
+    if (overhead < 0)
+    {
+        std::vector<double> samples(1001);
+        for (auto& sample : samples)
+        {
+            auto start = clock_type::now();
+            sample = elapsed_ns(start, clock_type::now());
+        }
+        std::nth_element(samples.begin(), samples.begin() + 500, samples.end());
+        overhead = samples[500];
+    }
+    return overhead;
+}
+
+struct RESULT
+{
+    size_t ops;
+    double ns_per_op, p50, p99;
+};
+
+// run op(0), ..., op(n - 1), timing up to 100000 of them one by one
+template <typename T_OP>
+RESULT measure(size_t n, T_OP op)
+{
+    size_t stride = 1 + n / 100000;
+    double overhead = clock_overhead_ns(), sampled = 0;
+    std::vector<double> samples;
+    samples.reserve(n / stride + 1);
+
+    auto start = clock_type::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i % stride)
+        {
+            op(i);
+            continue;
+        }
+        auto t0 = clock_type::now();
+        op(i);
+        auto ns = elapsed_ns(t0, clock_type::now()) - overhead;
+        samples.push_back(ns > 0 ? ns : 0);
+        sampled += overhead;
+    }
+    double total = elapsed_ns(start, clock_type::now()) - sampled;
+
+    RESULT result = { n, (total > 0 ? total : 0) / double(n), 0, 0 };
+    std::sort(samples.begin(), samples.end());
+    result.p50 = samples[samples.size() / 2];
+    result.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    return result;
+}
+
+// print a row, and write it to the CSV file if any
+struct REPORT
+{
+    FILE *m_csv;
+
+    REPORT(FILE *csv) : m_csv(csv)
+    {
+        printf("%-8s %6s %-12s %9s %12s %10s %12s %10s %10s %10s\n", "alloc", "T_SIZE", "op",
+               "blocks", "image", "ops", "ns/op", "p50", "p99", "rss_kb");
+        if (m_csv)
+            fprintf(m_csv, "allocator,size_type,op,blocks,image_bytes,ops,ns_per_op,p50_ns,p99_ns,peak_rss_kb\n");
+    }
+
+    void operator()(const char *allocator, int size_type, const char *op, size_t blocks,
+                    size_t image, const RESULT& r)
+    {
+        auto rss = peak_rss_kb();
+        typedef unsigned long long ull;
+        printf("%-8s %6d %-12s %9llu %12llu %10llu %12.1f %10.0f %10.0f %10llu\n", allocator, size_type, op,
+               ull(blocks), ull(image), ull(r.ops), r.ns_per_op, r.p50, r.p99, ull(rss));
+        if (m_csv)
+        {
+            fprintf(m_csv, "%s,%d,%s,%llu,%llu,%llu,%.2f,%.0f,%.0f,%llu\n", allocator, size_type, op,
+                    ull(blocks), ull(image), ull(r.ops), r.ns_per_op, r.p50, r.p99, ull(rss));
+        }
+    }
+};
+
+static const char s_text[] = "Eyeball Allocation Table";
+static size_t s_sink;
+
+// moving a block in the middle may move the table below it, so realloc_
+// in random order takes the first 100000 blocks only
+const size_t c_max_random_ops = 100000;
+
+// the sizes of the blocks, 8 to 64 bytes, and an order to visit them
+void make_workload(size_t num, std::vector<size_t>& sizes, std::vector<size_t>& order)
+{
+    std::mt19937 random(20261016);
+    sizes.resize(num);
+    order.resize(num);
+    for (size_t i = 0; i < num; ++i)
+    {
+        sizes[i] = 8 + random() % 57;
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+}
+
+// malloc_, fetch_entry, realloc_, free_, strdup_, compact, merge and resize
+template <typename T_SIZE>
+void suite_eat(size_t num, REPORT& report)
+{
+    typedef EAT::MASTER<T_SIZE> master_type;
+    std::vector<size_t> sizes, order;
+    make_workload(num, sizes, order);
+    size_t data = 0;
+    for (auto siz : sizes)
+    {
+        data += siz + 8;
+    }
+
+    // room for realloc_ moving every block
+    size_t used = data + num * sizeof(typename master_type::entry_type);
+    size_t total = sizeof(EAT::HEAD<T_SIZE>) + 2 * used + 1024;
+    if (total != size_t(T_SIZE(total)))
+        return; // too large for T_SIZE
+
+    reset_peak_rss();
+    auto master = EAT::create_master<T_SIZE>(total);
+    if (!master)
+        return;
+    std::memset(static_cast<void *>(master), 0, total); // commit the pages
+    master->init(total);
+
+    int size_type = int(sizeof(T_SIZE));
+    std::vector<void *> ptrs(num);
+    report("eat", size_type, "malloc_", num, total, measure(num, [&](size_t i) {
+        ptrs[i] = master->malloc_(T_SIZE(sizes[i]));
+    }));
+    report("eat", size_type, "fetch_entry", num, total, measure(num, [&](size_t i) {
+        s_sink += (master->fetch_entry(ptrs[order[i]]) != NULL);
+    }));
+    size_t random_ops = std::min(num, c_max_random_ops);
+    report("eat", size_type, "realloc_", num, total, measure(random_ops, [&](size_t i) {
+        auto k = order[i];
+        ptrs[k] = master->realloc_(ptrs[k], T_SIZE(sizes[k] + 8));
+    }));
+    report("eat", size_type, "free_", num, total, measure(num, [&](size_t i) {
+        master->free_(ptrs[order[i]]);
+    }));
+    master->clear(false);
+    report("eat", size_type, "strdup_", num, total, measure(num, [&](size_t i) {
+        ptrs[i] = master->strdup_(s_text);
+    }));
+
+    // compact the half
+    master->clear(false);
+    for (size_t i = 0; i < num; ++i)
+    {
+        ptrs[i] = master->malloc_(T_SIZE(sizes[i]));
+    }
+    for (size_t i = 0; i < num; i += 2)
+    {
+        master->free_(ptrs[i]);
+    }
+    report("eat", size_type, "compact", num, total, measure(1, [&](size_t) {
+        master->compact();
+    }));
+
+    // merge a copy
+    master->clear(false);
+    auto src = EAT::create_master<T_SIZE>(total / 2);
+    for (size_t i = 0; i < num / 2; ++i)
+    {
+        master->malloc_(T_SIZE(sizes[i]));
+        src->malloc_(T_SIZE(sizes[num / 2 + i]));
+    }
+    report("eat", size_type, "merge", num, total, measure(1, [&](size_t) {
+        master->merge(*src);
+    }));
+    EAT::destroy_master(src);
+
+    // grow and shrink back
+    report("eat", size_type, "resize", num, total, measure(8, [&](size_t i) {
+        size_t new_total = (i % 2) ? total : std::min(total * 2, size_t(T_SIZE(-1)));
+        auto new_master = EAT::resize_master(master, new_total);
+        if (new_master)
+            master = new_master;
+    }));
+    EAT::destroy_master(master);
+}
+
+// the same workload on the system malloc
+void suite_system(size_t num, REPORT& report)
+{
+    std::vector<size_t> sizes, order;
+    make_workload(num, sizes, order);
+    reset_peak_rss();
+
+    std::vector<void *> ptrs(num);
+    report("system", 0, "malloc_", num, 0, measure(num, [&](size_t i) {
+        ptrs[i] = malloc(sizes[i]);
+    }));
+    size_t random_ops = std::min(num, c_max_random_ops);
+    report("system", 0, "realloc_", num, 0, measure(random_ops, [&](size_t i) {
+        auto k = order[i];
+        ptrs[k] = realloc(ptrs[k], sizes[k] + 8);
+    }));
+    report("system", 0, "free_", num, 0, measure(num, [&](size_t i) {
+        free(ptrs[order[i]]);
+    }));
+    report("system", 0, "strdup_", num, 0, measure(num, [&](size_t i) {
+        ptrs[i] = malloc(sizeof(s_text));
+        memcpy(ptrs[i], s_text, sizeof(s_text));
+    }));
+    for (auto ptr : ptrs)
+    {
+        free(ptr);
+    }
+}
+
+void run_suite(size_t max_blocks, FILE *csv)
+{
+    printf("## workload suite\n");
+    REPORT report(csv);
+    for (size_t num = 10; num <= max_blocks; num *= 10)
+    {
+        suite_eat<uint16_t>(num, report);
+        suite_eat<uint32_t>(num, report);
+        suite_eat<uint64_t>(num, report);
+        suite_system(num, report);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// the micro benchmarks
+
+// malloc_/free_ one by one versus malloc_batch/free_batch
+void bench_batch(size_t n, uint32_t siz)
+{
+    printf("## %u blocks of %u bytes, ns/block\n", unsigned(n), unsigned(siz));
+    auto master = EAT::create_master<uint32_t>(256 + n * (siz + 3 * sizeof(uint32_t) + 8));
+    std::vector<uint32_t> sizes(n, siz);
+    std::vector<void *> ptrs(n);
+
+    auto start = clock_type::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        ptrs[i] = master->malloc_(siz);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        master->free_(ptrs[i]);
+    }
+    auto ns_single = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+
+    start = clock_type::now();
+    master->malloc_batch(&sizes[0], n, &ptrs[0]);
+    master->free_batch(&ptrs[0], n);
+    auto ns_batch = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+
+    printf("%12s %12.2f\n%12s %12.2f\n", "single", double(ns_single) / n, "batch", double(ns_batch) / n);
+    EAT::destroy_master(master);
+}
+
+// fold the shards into one master: merge one by one versus merge_many
+void bench_merge(size_t num_shards, size_t blocks_per_shard, uint32_t siz)
+{
+    printf("## merge %u shards of %u blocks, ms\n", unsigned(num_shards), unsigned(blocks_per_shard));
+    typedef EAT::MASTER<uint32_t> master_type;
+    std::vector<master_type *> shards(num_shards);
+    std::vector<uint32_t> sizes(blocks_per_shard, siz);
+    std::vector<void *> ptrs(blocks_per_shard);
+    for (auto& shard : shards)
+    {
+        shard = EAT::create_master<uint32_t>(256 + blocks_per_shard * (siz + 3 * sizeof(uint32_t) + 8));
+        shard->malloc_batch(&sizes[0], blocks_per_shard, &ptrs[0]);
+    }
+
+    auto ms = [](clock_type::time_point start) {
+        return double(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start).count()) / 1000;
+    };
+    auto srcs = &shards[0];
+
+    auto start = clock_type::now();
+    auto master = EAT::create_master<uint32_t>(256);
+    for (auto shard : shards)
+    {
+        master = EAT::resize_master(master, master->total_size() + master->merge_room(*shard));
+        master->merge(*shard);
+    }
+    double ms_single = ms(start);
+    EAT::destroy_master(master);
+
+    start = clock_type::now();
+    master = EAT::grow_for_merge(EAT::create_master<uint32_t>(256), srcs, num_shards);
+    master->merge_many(srcs, num_shards);
+    double ms_many = ms(start);
+    EAT::destroy_master(master);
+
+    EAT::PARALLEL_RUNNER runner;
+    start = clock_type::now();
+    master = EAT::grow_for_merge(EAT::create_master<uint32_t>(256), srcs, num_shards);
+    master->merge_many(srcs, num_shards, runner);
+    double ms_parallel = ms(start);
+    EAT::destroy_master(master);
+
+    printf("%12s %12.2f\n%12s %12.2f\n%12s %12.2f\n", "merge", ms_single, "merge_many", ms_many,
+           "parallel", ms_parallel);
+    for (auto shard : shards)
+    {
+        EAT::destroy_master(shard);
+    }
+}
+
+// sweep the table for the holes, one in 1024 entries, by each kernel
+template <typename T_SIZE>
+void bench_scan(size_t num)
+{
+    typedef EAT::MASTER<T_SIZE> master_type;
+    size_t total_size = 256 + num * (1 + sizeof(typename master_type::entry_type));
+    if (total_size != T_SIZE(total_size))
+        return; // too large for T_SIZE
+
+    auto master = EAT::create_master<T_SIZE>(total_size);
+    std::vector<T_SIZE> sizes(num, 1);
+    std::vector<void *> ptrs(num);
+    master->malloc_batch(&sizes[0], num, &ptrs[0]);
+    auto entries = master->get_entries();
+    for (size_t i = 1; i < num; i += 1024)
+    {
+        entries[i].invalidate();
+    }
+
+    printf("%8d %8u", int(sizeof(T_SIZE)), unsigned(num));
+    auto& level = EAT::detail::simd_level();
+    auto detected = level;
+    for (int l = EAT::detail::SIMD_NONE; l <= EAT::detail::SIMD_AVX2; ++l)
+    {
+        if (l > detected || EAT::detail::simd_kernel<T_SIZE>(l) != l)
+        {
+            printf(" %10s", "-"); // not available, or not used for T_SIZE
+            continue;
+        }
+        level = l;
+        size_t repeat = 1 + (1 << 24) / num, holes = 0;
+        auto start = clock_type::now();
+        for (size_t r = 0; r < repeat; ++r)
+        {
+            for (auto i = master->next_entry(0, false); i < master->num_entries();
+                 i = master->next_entry(T_SIZE(i + 1), false))
+            {
+                ++holes;
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+        s_sink += holes;
+        printf(" %10.3f", double(ns) / double(repeat * num));
+    }
+    printf("\n");
+    level = detected;
+    EAT::destroy_master(master);
+}
+
+void usage(void)
+{
+    printf("Usage: eat-bench [--max-blocks N] [--csv FILE] [--suite-only]\n");
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_blocks = 100000;
+    const char *csv_path = NULL;
+    bool suite_only = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--max-blocks") == 0 && i + 1 < argc)
+            max_blocks = size_t(strtoull(argv[++i], NULL, 10));
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "--suite-only") == 0)
+            suite_only = true;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    FILE *csv = NULL;
+    if (csv_path && !(csv = fopen(csv_path, "w")))
+    {
+        fprintf(stderr, "eat-bench: cannot open %s\n", csv_path);
+        return 1;
+    }
+    run_suite(max_blocks, csv);
+    if (csv)
+        fclose(csv);
+    if (suite_only)
+        return 0;
+
+    printf("## hole scan, ns/entry\n");
+    printf("%8s %8s %10s %10s %10s\n", "T_SIZE", "entries", "scalar", "sse2", "avx2");
+    for (size_t num = 1000; num <= 1000000; num *= 10)
+    {
+        bench_scan<uint16_t>(num);
+        bench_scan<uint32_t>(num);
+        bench_scan<uint64_t>(num);
+    }
+    bench_batch(100000, 16);
+    bench_merge(64, 10000, 32);
+    return 0;
+}
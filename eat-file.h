@@ -0,0 +1,431 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+// The file-backed and the reserved masters. They need the virtual memory
+// of the OS.
+
+#ifndef EYEBALL_ALLOCATION_TABLE_FILE
+#define EYEBALL_ALLOCATION_TABLE_FILE
+
+#include "eat.h"
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace EAT
+{
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::FILE_MODE --- how to map the file
+
+    enum FILE_MODE
+    {
+        FILE_READ_ONLY,     // the image cannot be modified
+        FILE_READ_WRITE,    // the modification is written to the file
+        FILE_PRIVATE,       // the modification is not written to the file
+        FILE_UPGRADE        // FILE_READ_WRITE, and an older image is upgraded
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::create_master_file<T_SIZE>(path, total_size)
+    // EAT::open_master_file<T_SIZE>(path, mode = FILE_READ_WRITE)
+    // EAT::sync_master<T_SIZE>(master)
+    // EAT::close_master_file<T_SIZE>(master)
+    //
+    // NOTE: The file is mapped as a whole and paged in on demand. Opening
+    //       does not touch the image. An image of an older version is
+    //       upgraded in the file with FILE_UPGRADE only, and in the private
+    //       copy with FILE_PRIVATE; the other modes refuse it.
+
+    namespace detail
+    {
+        // map the file of the handle/descriptor
+#ifdef _WIN32
+        inline void *map_file(HANDLE hFile, size_t size, FILE_MODE mode)
+        {
+            DWORD protect = PAGE_READWRITE, access = FILE_MAP_WRITE;
+            if (mode == FILE_READ_ONLY)
+            {
+                protect = PAGE_READONLY;
+                access = FILE_MAP_READ;
+            }
+            else if (mode == FILE_PRIVATE)
+            {
+                protect = PAGE_WRITECOPY;
+                access = FILE_MAP_COPY;
+            }
+            HANDLE hMapping = ::CreateFileMappingA(hFile, NULL, protect, 0, 0, NULL);
+            if (!hMapping)
+                return NULL;
+            void *ptr = ::MapViewOfFile(hMapping, access, 0, 0, size);
+            ::CloseHandle(hMapping);
+            return ptr;
+        }
+#else
+        inline void *map_file(int fd, size_t size, FILE_MODE mode)
+        {
+            int prot = PROT_READ | PROT_WRITE, flags = MAP_SHARED;
+            if (mode == FILE_READ_ONLY)
+                prot = PROT_READ;
+            else if (mode == FILE_PRIVATE)
+                flags = MAP_PRIVATE;
+            void *ptr = ::mmap(NULL, size, prot, flags, fd, 0);
+            return (ptr == MAP_FAILED) ? NULL : ptr;
+        }
+#endif
+
+        inline size_t page_size()
+        {
+#ifdef _WIN32
+            SYSTEM_INFO info;
+            ::GetSystemInfo(&info);
+            return info.dwPageSize;
+#else
+            return size_t(::sysconf(_SC_PAGESIZE));
+#endif
+        }
+        inline size_t round_to_pages(size_t size)
+        {
+            auto page = page_size();
+            return (size + page - 1) / page * page;
+        }
+
+        // the page before a reserved master
+        struct RESERVATION
+        {
+            size_t m_reserved;      // the reserved size for the master
+            size_t m_committed;     // the committed size for the master
+        };
+        inline RESERVATION *reservation_of(void *master)
+        {
+            return reinterpret_cast<RESERVATION *>(reinterpret_cast<char *>(master) - page_size());
+        }
+    } // namespace detail
+
+    // flush the modification to the file
+    template <typename T_SIZE>
+    inline bool sync_master(MASTER<T_SIZE> *master)
+    {
+#ifdef _WIN32
+        return !!::FlushViewOfFile(master, master->total_size());
+#else
+        return ::msync(master, master->total_size(), MS_SYNC) == 0;
+#endif
+    }
+
+    template <typename T_SIZE>
+    inline void close_master_file(MASTER<T_SIZE> *master)
+    {
+        if (!master)
+            return;
+#ifdef _WIN32
+        ::UnmapViewOfFile(master);
+#else
+        ::munmap(master, master->total_size());
+#endif
+    }
+
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *create_master_file(const char *path, size_t total_size)
+    {
+        if (total_size != T_SIZE(total_size) || total_size < sizeof(HEAD<T_SIZE>))
+            return NULL; // invalid size
+
+        void *ptr;
+#ifdef _WIN32
+        HANDLE hFile = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                                     NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return NULL;
+        LARGE_INTEGER li;
+        li.QuadPart = LONGLONG(total_size);
+        if (!::SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !::SetEndOfFile(hFile))
+        {
+            ::CloseHandle(hFile);
+            return NULL;
+        }
+        ptr = detail::map_file(hFile, total_size, FILE_READ_WRITE);
+        ::CloseHandle(hFile);
+#else
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return NULL;
+        if (::ftruncate(fd, off_t(total_size)) != 0)
+        {
+            ::close(fd);
+            return NULL;
+        }
+        ptr = detail::map_file(fd, total_size, FILE_READ_WRITE);
+        ::close(fd);
+#endif
+        if (!ptr)
+            return NULL;
+
+        auto master = reinterpret_cast<MASTER<T_SIZE> *>(ptr);
+        master->init(total_size);
+        return master;
+    }
+
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *open_master_file(const char *path, FILE_MODE mode = FILE_READ_WRITE)
+    {
+        // read the header to know the size
+        HEAD<T_SIZE> head;
+        void *ptr;
+        bool writable = (mode == FILE_READ_WRITE || mode == FILE_UPGRADE);
+#ifdef _WIN32
+        DWORD access = GENERIC_READ;
+        if (writable)
+            access |= GENERIC_WRITE;
+        HANDLE hFile = ::CreateFileA(path, access, FILE_SHARE_READ, NULL,
+                                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return NULL;
+        DWORD cbRead;
+        LARGE_INTEGER li;
+        if (!::ReadFile(hFile, &head, sizeof(head), &cbRead, NULL) || cbRead != sizeof(head) ||
+            !::GetFileSizeEx(hFile, &li) || ULONGLONG(li.QuadPart) < ULONGLONG(head.m_total_size) ||
+            head.m_total_size < sizeof(head))
+        {
+            ::CloseHandle(hFile);
+            return NULL;
+        }
+        ptr = detail::map_file(hFile, head.m_total_size, mode);
+        ::CloseHandle(hFile);
+#else
+        int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            return NULL;
+        struct stat st;
+        if (::pread(fd, &head, sizeof(head), 0) != ssize_t(sizeof(head)) ||
+            ::fstat(fd, &st) != 0 || st.st_size < off_t(head.m_total_size) ||
+            head.m_total_size < sizeof(head))
+        {
+            ::close(fd);
+            return NULL;
+        }
+        ptr = detail::map_file(fd, head.m_total_size, mode);
+        ::close(fd);
+#endif
+        if (!ptr)
+            return NULL;
+
+        auto master = reinterpret_cast<MASTER<T_SIZE> *>(ptr);
+        bool upgradable = (mode == FILE_UPGRADE || mode == FILE_PRIVATE);
+        if (!master->is_intact() && (!upgradable || !master->upgrade()))
+        {
+            close_master_file(master);
+            return NULL; // not an image
+        }
+        return master;
+    }
+
+    // resize the mapped file without copying the image.
+    // the mapping may move. returns NULL if failed; then the old mapping is kept.
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *resize_master_file(MASTER<T_SIZE> *master, const char *path,
+                                              size_t new_total_size)
+    {
+        size_t old_total_size = master->total_size();
+        if (new_total_size != T_SIZE(new_total_size))
+            return NULL; // too large
+        if (new_total_size == old_total_size)
+            return master;
+
+        bool grow = (new_total_size > old_total_size);
+        if (!grow && !master->resize(T_SIZE(new_total_size))) // move the table first
+            return NULL;
+        sync_master(master);
+
+        void *ptr;
+#ifdef _WIN32
+        HANDLE hFile = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                                     NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return NULL;
+        LARGE_INTEGER li;
+        li.QuadPart = LONGLONG(new_total_size);
+        if (grow && (!::SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !::SetEndOfFile(hFile)))
+        {
+            ::CloseHandle(hFile);
+            return NULL;
+        }
+        ptr = detail::map_file(hFile, new_total_size, FILE_READ_WRITE);
+        if (ptr)
+        {
+            ::UnmapViewOfFile(master); // the old view is dropped only after the new one is made
+            if (!grow && ::SetFilePointerEx(hFile, li, NULL, FILE_BEGIN)) // a larger file is harmless
+                ::SetEndOfFile(hFile);
+        }
+        ::CloseHandle(hFile);
+#else
+        int fd = ::open(path, O_RDWR);
+        if (fd < 0)
+            return NULL;
+        if (grow && ::ftruncate(fd, off_t(new_total_size)) != 0)
+        {
+            ::close(fd);
+            return NULL;
+        }
+    #if defined(__linux__) && defined(MREMAP_MAYMOVE)
+        ptr = ::mremap(master, old_total_size, new_total_size, MREMAP_MAYMOVE);
+        if (ptr == MAP_FAILED)
+            ptr = NULL;
+    #else
+        ptr = detail::map_file(fd, new_total_size, FILE_READ_WRITE);
+        if (ptr)
+            ::munmap(master, old_total_size); // the old view is dropped only after the new one is made
+    #endif
+        if (ptr && !grow)
+        {
+            // a larger file is harmless, so the result is ignored
+            int ret = ::ftruncate(fd, off_t(new_total_size));
+            (void)ret;
+        }
+        ::close(fd);
+#endif
+        if (!ptr)
+            return NULL;
+
+        master = reinterpret_cast<MASTER<T_SIZE> *>(ptr);
+        if (grow)
+            master->resize(T_SIZE(new_total_size));
+        return master;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::reserve_master<T_SIZE>(reserved_size, total_size)
+    // EAT::commit_master<T_SIZE>(master, new_total_size)
+    // EAT::grow_malloc<T_SIZE>(master, siz)
+    // EAT::release_master<T_SIZE>(master)
+    //
+    // NOTE: A reserved master owns a range of the address space and commits
+    //       its pages as it grows, so it grows without moving. Growing costs
+    //       only moving the entry table.
+
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *reserve_master(size_t reserved_size, size_t total_size)
+    {
+        if (total_size > reserved_size || reserved_size != T_SIZE(reserved_size) ||
+            total_size < sizeof(HEAD<T_SIZE>))
+        {
+            return NULL; // invalid size
+        }
+
+        auto page = detail::page_size();
+        auto committed = detail::round_to_pages(total_size);
+        auto range = page + detail::round_to_pages(reserved_size);
+#ifdef _WIN32
+        auto base = reinterpret_cast<char *>(::VirtualAlloc(NULL, range, MEM_RESERVE, PAGE_NOACCESS));
+        if (!base)
+            return NULL;
+        if (!::VirtualAlloc(base, page + committed, MEM_COMMIT, PAGE_READWRITE))
+        {
+            ::VirtualFree(base, 0, MEM_RELEASE);
+            return NULL;
+        }
+#else
+        auto ptr = ::mmap(NULL, range, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED)
+            return NULL;
+        auto base = reinterpret_cast<char *>(ptr);
+        if (::mprotect(base, page + committed, PROT_READ | PROT_WRITE) != 0)
+        {
+            ::munmap(base, range);
+            return NULL;
+        }
+#endif
+
+        auto master = reinterpret_cast<MASTER<T_SIZE> *>(base + page);
+        auto reservation = detail::reservation_of(master);
+        reservation->m_reserved = reserved_size;
+        reservation->m_committed = committed;
+        master->init(total_size);
+        return master;
+    }
+
+    // grow or shrink the reserved master in place
+    template <typename T_SIZE>
+    inline bool commit_master(MASTER<T_SIZE> *master, size_t new_total_size)
+    {
+        auto reservation = detail::reservation_of(master);
+        if (new_total_size > reservation->m_reserved)
+            return false; // too large
+
+        auto base = reinterpret_cast<char *>(master);
+        auto committed = detail::round_to_pages(new_total_size);
+        if (committed > reservation->m_committed) // commit more
+        {
+            auto ptr = base + reservation->m_committed;
+            auto size = committed - reservation->m_committed;
+#ifdef _WIN32
+            if (!::VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE))
+                return false;
+#else
+            if (::mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+                return false;
+#endif
+            reservation->m_committed = committed;
+        }
+
+        if (!master->resize(T_SIZE(new_total_size)))
+            return false;
+
+        if (committed < reservation->m_committed) // decommit the rest
+        {
+            auto ptr = base + committed;
+            auto size = reservation->m_committed - committed;
+#ifdef _WIN32
+            ::VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+            ::madvise(ptr, size, MADV_DONTNEED);
+            ::mprotect(ptr, size, PROT_NONE);
+#endif
+            reservation->m_committed = committed;
+        }
+        return true;
+    }
+
+    // malloc_ on the reserved master, growing it geometrically if necessary
+    template <typename T_SIZE>
+    inline void *grow_malloc(MASTER<T_SIZE> *master, size_t siz)
+    {
+        if (siz != T_SIZE(siz))
+            return NULL; // too large
+        void *ptr = master->malloc_(T_SIZE(siz));
+        if (ptr)
+            return ptr;
+
+        size_t required = siz + master->entry_size() + master->alignment() - 1;
+        auto new_total_size = grown_size(master, required, detail::reservation_of(master)->m_reserved);
+        if (!new_total_size || !commit_master(master, new_total_size))
+            return NULL; // out of memory
+        return master->malloc_(T_SIZE(siz));
+    }
+
+    template <typename T_SIZE>
+    inline void release_master(MASTER<T_SIZE> *master)
+    {
+        if (!master)
+            return;
+        auto base = reinterpret_cast<char *>(detail::reservation_of(master));
+#ifdef _WIN32
+        ::VirtualFree(base, 0, MEM_RELEASE);
+#else
+        auto range = detail::page_size() +
+                     detail::round_to_pages(detail::reservation_of(master)->m_reserved);
+        ::munmap(base, range);
+#endif
+    }
+} // namespace EAT
+
+#endif  // ndef EYEBALL_ALLOCATION_TABLE_FILE
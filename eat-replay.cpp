@@ -0,0 +1,137 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+// eat-replay --- replays an allocation trace and reports the time, the
+// fragmentation and the failure points.
+
+#include "eat.h"
+#include "eat-trace.h"
+#include <cstdlib>
+
+static const char *const s_op_names[EAT::TRACE_NUM_OPS] =
+{
+    "base", "malloc_", "calloc_", "realloc_", "free_", "compact", "merge"
+};
+
+template <typename T_SIZE>
+int replay_file(FILE *fp, size_t total_size, size_t alignment)
+{
+    if (total_size != size_t(T_SIZE(total_size)))
+    {
+        fprintf(stderr, "eat-replay: the total size is too large for the size type\n");
+        return 1;
+    }
+    auto master = EAT::create_master<T_SIZE>(total_size, EAT_MASTER_ALIGNMENT); // any alignment
+    if (!master || !master->set_alignment(T_SIZE(alignment)))
+    {
+        fprintf(stderr, "eat-replay: cannot create the master\n");
+        EAT::destroy_master(master);
+        return 1;
+    }
+
+    printf("## master: T_SIZE %d, total %zu, alignment %zu\n",
+           int(sizeof(T_SIZE)), total_size, alignment);
+
+    EAT::REPLAY_RESULT result;
+    bool ok = EAT::replay(master, fp, result);
+    if (!ok)
+        fprintf(stderr, "eat-replay: the trace is broken; the report is up to the break\n");
+
+    printf("%10s %10s %10s\n", "op", "calls", "ns/call");
+    for (int op = 0; op < EAT::TRACE_NUM_OPS; ++op)
+    {
+        if (!result.m_calls[op])
+            continue;
+        printf("%10s %10zu %10.1f\n", s_op_names[op], result.m_calls[op],
+               result.m_ns[op] / double(result.m_calls[op]));
+    }
+
+    printf("failures: %zu", result.m_failures.size());
+    for (size_t k = 0; k < result.m_failures.size() && k < 10; ++k)
+    {
+        printf("%s#%zu", k ? ", " : " at ", result.m_failures[k]);
+    }
+    printf("%s\n", result.m_failures.size() > 10 ? ", ..." : "");
+    if (result.m_recovered)
+        printf("recovered: %zu (failed in the trace)\n", result.m_recovered);
+
+    auto& frag = result.m_final;
+    printf("peak used: %zu / %zu\n", result.m_peak_used, size_t(master->total_size()));
+    printf("final: %zu holes, %zu hole bytes, %zu free area, %zu largest, fragmentation %.3f\n",
+           frag.m_holes, frag.m_hole_bytes, frag.m_free_area, frag.m_largest, frag.ratio());
+    printf("worst fragmentation: %.3f\n", result.m_worst_ratio);
+
+    EAT::destroy_master(master);
+    return ok ? 0 : 1;
+}
+
+void usage(void)
+{
+    printf("Usage: eat-replay TRACE [--size-type 2|4|8] [--total BYTES] [--alignment N]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int size_type = 4;
+    size_t total_size = 0, alignment = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--size-type") == 0 && i + 1 < argc)
+            size_type = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--total") == 0 && i + 1 < argc)
+            total_size = size_t(strtoull(argv[++i], NULL, 10));
+        else if (strcmp(argv[i], "--alignment") == 0 && i + 1 < argc)
+            alignment = size_t(strtoull(argv[++i], NULL, 10));
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (!path || (size_type != 2 && size_type != 4 && size_type != 8))
+    {
+        usage();
+        return 1;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "eat-replay: cannot open %s\n", path);
+        return 1;
+    }
+    EAT::TRACE_HEADER header;
+    if (!EAT::read_trace_header(fp, header))
+    {
+        fprintf(stderr, "eat-replay: %s is not a trace\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    // as recorded by default
+    if (!total_size)
+        total_size = size_t(header.m_total_size);
+    if (!alignment)
+        alignment = size_t(header.m_alignment);
+    printf("## trace: %s (recorded on total %zu, alignment %zu)\n", path,
+           size_t(header.m_total_size), size_t(header.m_alignment));
+
+    int ret;
+    switch (size_type)
+    {
+    case 2:
+        ret = replay_file<uint16_t>(fp, total_size, alignment);
+        break;
+    case 4:
+        ret = replay_file<uint32_t>(fp, total_size, alignment);
+        break;
+    default:
+        ret = replay_file<uint64_t>(fp, total_size, alignment);
+        break;
+    }
+    fclose(fp);
+    return ret;
+}
@@ -3,6 +3,12 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "eat.h"
+#include "eat-file.h"
+#include "eat-thread.h"
+#include "eat-trace.h"
+#include "eat-alloc.h"
+#include <vector>
+#include <thread>
 
 template <typename T_SIZE, T_SIZE t_total_size>
 void test1(void)
@@ -43,6 +49,2274 @@ void test1(void)
     EAT::destroy_master(master);
 }
 
+template <typename T_SIZE, T_SIZE t_total_size>
+void test2(void)
+{
+    printf("## test2(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+
+    // allocate blocks of various sizes
+    void *ptrs[32];
+    for (int i = 0; i < 32; ++i)
+    {
+        ptrs[i] = master->malloc_(T_SIZE(i + 1));
+        assert(ptrs[i] != NULL);
+    }
+    for (int i = 0; i < 32; ++i)
+    {
+        assert(master->_msize_(ptrs[i]) == T_SIZE(i + 1));
+    }
+
+    // not the head of a block
+    assert(master->fetch_entry(reinterpret_cast<char *>(ptrs[5]) + 1) == NULL);
+
+    // free the odd ones and compact
+    for (int i = 1; i < 32; i += 2)
+    {
+        master->free_(ptrs[i]);
+    }
+    master->compact();
+    assert(master->num_entries() == 16);
+
+    // the moved blocks can be found again
+    auto entries = master->get_entries();
+    for (T_SIZE i = 0; i < master->num_entries(); ++i)
+    {
+        void *ptr = master->ptr_from_offset(entries[i].m_offset);
+        assert(master->fetch_entry(ptr) == &entries[i]);
+        assert(master->_msize_(ptr) == T_SIZE(2 * (15 - i) + 1));
+    }
+
+    // merge and find the merged ones
+    auto master2 = EAT::create_master<T_SIZE>(t_total_size);
+    void *p1 = master2->malloc_(7);
+    void *p2 = master2->malloc_(9);
+    assert(p1 && p2);
+    auto diff = master->offset_from_ptr(master->get_free_area()) - master2->head_size();
+    assert(master->merge(*master2));
+    assert(master->num_entries() == 18);
+    assert(master->_msize_(master->ptr_from_offset(T_SIZE(master2->offset_from_ptr(p1) + diff))) == 7);
+    assert(master->_msize_(master->ptr_from_offset(T_SIZE(master2->offset_from_ptr(p2) + diff))) == 9);
+
+    EAT::destroy_master(master2);
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test3(void)
+{
+    printf("## test3(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+
+    // fill the master
+    void *ptrs[256];
+    int count = 0;
+    while (count < 256)
+    {
+        ptrs[count] = master->malloc_(20);
+        if (!ptrs[count])
+            break;
+        ++count;
+    }
+    assert(count > 8 && count < 256);
+    assert(master->malloc_(20) == NULL);
+
+    // coalesce the neighbor holes and split them
+    auto num = master->num_entries();
+    master->free_(ptrs[2]);
+    master->free_(ptrs[4]);
+    master->free_(ptrs[3]);
+    assert(master->num_entries() == num); // coalesced lazily
+    void *p1 = master->reuse_hole(30);
+    assert(p1 == ptrs[2]);
+    assert(master->num_entries() == num - 1);
+    void *p2 = master->reuse_hole(25);
+    assert(p2 == reinterpret_cast<char *>(ptrs[2]) + 30);
+    assert(master->num_entries() == num - 1);
+    assert(master->_msize_(p1) == 30);
+    assert(master->_msize_(p2) == 25);
+    ptrs[2] = p1;
+    ptrs[3] = p2;
+    ptrs[4] = NULL;
+
+    // make holes and reuse them
+    num = master->num_entries();
+    for (int i = 5; i < count - 1; i += 2)
+    {
+        master->free_(ptrs[i]);
+    }
+    for (int i = 5; i < count - 1; i += 2)
+    {
+        ptrs[i] = master->malloc_(20);
+        assert(ptrs[i] != NULL);
+        assert(master->_msize_(ptrs[i]) == 20);
+    }
+    assert(master->num_entries() <= num + 1); // one may fit in the free area
+
+    // free all
+    for (int i = 0; i < count; ++i)
+    {
+        master->free_(ptrs[i]);
+    }
+    assert(master->empty());
+    assert(master->data_area_size() == 0);
+
+    // a run of the holes is one hole
+    char *blocks[5];
+    for (int i = 0; i < 5; ++i)
+    {
+        blocks[i] = reinterpret_cast<char *>(master->malloc_(24));
+        std::memset(blocks[i], 'A' + i, 24);
+    }
+    master->free_(blocks[1]);
+    master->free_(blocks[2]);
+    assert(master->num_entries() == 5);
+    assert(EAT::fragmentation(*master).m_holes == 1);
+    assert(EAT::fragmentation(*master).m_hole_bytes == 48);
+    assert(master->realloc_(blocks[0], 40) == blocks[0]); // grows into the run
+    assert(master->num_entries() == 4);
+    assert(EAT::fragmentation(*master).m_hole_bytes == 32);
+    master->free_(blocks[3]);
+    assert(master->num_entries() == 4);
+    assert(master->compact_step(size_t(-1)));
+    assert(master->num_entries() == 2);
+    assert(master->get_entries()[0].m_offset == master->head_size() + 40);
+    assert(*reinterpret_cast<char *>(master->ptr_from_offset(master->get_entries()[0].m_offset)) == 'E');
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test4(void)
+{
+    printf("## test4(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+
+    // grow the top block in place
+    char *p1 = reinterpret_cast<char *>(master->malloc_(10));
+    assert(p1 != NULL);
+    std::memcpy(p1, "0123456789", 10);
+    for (T_SIZE siz = 20; siz <= 200; siz += 10)
+    {
+        void *ptr = master->realloc_(p1, siz);
+        assert(ptr == p1);
+        assert(master->_msize_(p1) == siz);
+        assert(master->free_area_size() == t_total_size - master->head_size() - siz - master->entry_size());
+    }
+    assert(memcmp(p1, "0123456789", 10) == 0);
+
+    // shrink a block under another one and regrow it
+    char *p2 = reinterpret_cast<char *>(master->malloc_(10));
+    assert(master->realloc_(p1, 50) == p1);
+    assert(master->num_entries() == 3); // the rest became a hole
+    assert(master->get_entries()[1].m_data_size == 150);
+    assert(master->realloc_(p1, 40) == p1);
+    assert(master->get_entries()[1].m_data_size == 160); // the hole grows downward
+    char *p3 = reinterpret_cast<char *>(master->realloc_(p1, 150));
+    assert(p3 == p1);
+    assert(master->num_entries() == 3);
+    assert(master->get_entries()[1].m_data_size == 50); // the hole shrinks
+    assert(master->realloc_(p1, 200) == p1);
+    assert(master->num_entries() == 2); // the hole was eaten
+    assert(master->_msize_(p1) == 200);
+    assert(master->_msize_(p2) == 10);
+
+    // no room after it; move it
+    char *p4 = reinterpret_cast<char *>(master->realloc_(p1, 201));
+    assert(p4 != NULL && p4 != p1);
+    assert(memcmp(p4, "0123456789", 10) == 0);
+    assert(master->_msize_(p4) == 201);
+    assert(master->_msize_(p2) == 10);
+
+    master->free_(p2);
+    master->free_(p4);
+    assert(master->empty());
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test5(void)
+{
+    printf("## test5(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size, 64);
+    assert(reinterpret_cast<uintptr_t>(master) % 64 == 0);
+    assert(master->alignment() == 1);
+    assert(!master->set_alignment(3));
+    assert(master->set_alignment(8));
+    assert(master->alignment() == 8);
+    assert(master->is_valid());
+
+    // the default alignment
+    char *psz1 = master->strdup_("A");
+    char *psz2 = master->strdup_("BC");
+    char *psz3 = master->strdup_("DEF");
+    assert(master->offset_from_ptr(psz1) % 8 == 0);
+    assert(master->offset_from_ptr(psz2) % 8 == 0);
+    assert(master->offset_from_ptr(psz3) % 8 == 0);
+
+    // the explicit alignment
+    void *p1 = master->aligned_malloc_(5, 64);
+    assert(p1 != NULL);
+    assert(master->offset_from_ptr(p1) % 64 == 0);
+    assert(master->fetch_entry(p1)->alignment() == 64);
+    assert(reinterpret_cast<uintptr_t>(p1) % 64 == 0);
+    assert(master->aligned_malloc_(5, 3) == NULL);
+    assert(master->aligned_malloc_(5, T_SIZE(EAT_MASTER_ALIGNMENT * 2)) == NULL);
+
+    // compact keeps the alignment
+    master->free_(psz2);
+    master->compact();
+    auto entries = master->get_entries();
+    assert(master->num_entries() == 3);
+    assert(entries[2].m_offset + 8 == entries[1].m_offset);
+    assert(entries[0].m_offset % 64 == 0);
+    assert(strcmp(reinterpret_cast<char *>(master->ptr_from_offset(entries[1].m_offset)), "DEF") == 0);
+
+    // merge keeps the alignment; grow_for_merge aligns the image for it
+    auto master2 = EAT::create_master<T_SIZE>(t_total_size);
+    assert(reinterpret_cast<uintptr_t>(master2) % alignof(std::max_align_t) == 0);
+    master2->malloc_(1);
+    void *p2 = master2->aligned_malloc_(3, 16);
+    assert(master2->offset_from_ptr(p2) % 16 == 0);
+    assert(reinterpret_cast<uintptr_t>(p2) % 16 == 0);
+    auto offset2 = master2->offset_from_ptr(p2);
+    const master_type *srcs[] = { master };
+    master2 = EAT::grow_for_merge(master2, srcs, 1);
+    assert(master2 != NULL && reinterpret_cast<uintptr_t>(master2) % 64 == 0);
+    p2 = master2->ptr_from_offset(offset2);
+    assert(master2->merge(*master));
+    assert(master2->image_alignment() == 64);
+    entries = master2->get_entries();
+    for (T_SIZE i = 0; i < master2->num_entries(); ++i)
+    {
+        assert(entries[i].m_offset % entries[i].alignment() == 0);
+    }
+
+    // reuse an aligned hole
+    master2->free_(p2);
+    void *p3 = master2->reuse_hole(4, 16);
+    assert(p3 != NULL);
+    assert(master2->offset_from_ptr(p3) % 16 == 0);
+    assert(reinterpret_cast<uintptr_t>(p3) % 16 == 0);
+
+    // the image moved by resize_master is aligned as well
+    auto offset3 = master2->offset_from_ptr(p3);
+    master2 = EAT::resize_master(master2, t_total_size + 100);
+    assert(master2 != NULL);
+    assert(reinterpret_cast<uintptr_t>(master2->ptr_from_offset(offset3)) % 16 == 0);
+    void *p4 = master2->aligned_malloc_(2, 64);
+    assert(p4 != NULL && reinterpret_cast<uintptr_t>(p4) % 64 == 0);
+
+    EAT::destroy_master(master2);
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test6(void)
+{
+    printf("## test6(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef typename EAT::MASTER<T_SIZE>::handle_type handle_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+
+    // allocate handles
+    handle_type handles[20];
+    for (int i = 0; i < 20; ++i)
+    {
+        handles[i] = master->alloc_handle(T_SIZE(i + 4));
+        assert(handles[i] != 0);
+        assert(master->handle_size(handles[i]) == T_SIZE(i + 4));
+        std::memset(master->deref(handles[i]), 'A' + i, i + 4);
+    }
+    assert(master->deref(0) == NULL);
+    assert(master->deref(1000) == NULL);
+
+    // free some and compact
+    void *ptr = master->malloc_(3);
+    for (int i = 0; i < 20; i += 3)
+    {
+        master->free_handle(handles[i]);
+        assert(master->deref(handles[i]) == NULL);
+        handles[i] = 0;
+    }
+    master->free_(ptr);
+    master->compact();
+    for (int i = 0; i < 20; ++i)
+    {
+        if (!handles[i])
+            continue;
+        auto p = reinterpret_cast<char *>(master->deref(handles[i]));
+        assert(p != NULL);
+        for (int k = 0; k < i + 4; ++k)
+            assert(p[k] == 'A' + i);
+    }
+
+    // grow a handled block
+    assert(master->realloc_handle(handles[1], 100));
+    assert(master->handle_size(handles[1]) == 100);
+    assert(memcmp(master->deref(handles[1]), "BBBBB", 5) == 0);
+
+    // merge two masters with handles
+    auto master2 = EAT::create_master<T_SIZE>(t_total_size);
+    auto h1 = master2->alloc_handle(4);
+    std::memcpy(master2->deref(h1), "XYZ", 4);
+    auto base = master2->handle_capacity();
+    assert(master2->merge(*master));
+    for (int i = 0; i < 20; ++i)
+    {
+        if (!handles[i])
+            continue;
+        auto p = reinterpret_cast<char *>(master2->deref(T_SIZE(base + handles[i])));
+        assert(p != NULL);
+        assert(p[0] == 'A' + i);
+    }
+    assert(strcmp(reinterpret_cast<char *>(master2->deref(h1)), "XYZ") == 0);
+    master2->compact();
+    assert(strcmp(reinterpret_cast<char *>(master2->deref(h1)), "XYZ") == 0);
+    assert(memcmp(master2->deref(T_SIZE(base + handles[19])), "TTTT", 4) == 0);
+
+    // merge into an empty master
+    auto master3 = EAT::create_master<T_SIZE>(t_total_size);
+    master3->malloc_(1);
+    assert(master3->merge(*master));
+    assert(memcmp(master3->deref(handles[19]), "TTTT", 4) == 0);
+
+    EAT::destroy_master(master3);
+    EAT::destroy_master(master2);
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test7(void)
+{
+    printf("## test7(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::HEAD<T_SIZE> head_type;
+    typedef EAT::ENTRY_V4<T_SIZE> entry_type;
+
+    // make an image of version 3 by hand
+    auto image = reinterpret_cast<char *>(calloc(t_total_size, 1));
+    auto head = reinterpret_cast<head_type *>(image);
+    std::memcpy(head->m_magic, "EAT\0", 4);
+    head->m_flags = sizeof(T_SIZE);
+    head->m_total_size = t_total_size;
+    auto offset = head_type::v3_head_size();
+    std::memcpy(image + offset, "ABC", 4);
+    std::memcpy(image + offset + 4, "DE", 3);
+    head->m_boudary_1 = T_SIZE(offset + 7);
+    head->m_boudary_2 = T_SIZE(t_total_size - 2 * sizeof(entry_type));
+    auto entries = reinterpret_cast<entry_type *>(image + head->m_boudary_2);
+    entries[0].m_data_size = 3;
+    entries[0].m_offset = T_SIZE(offset + 4);
+    entries[0].m_flags = 1;
+    entries[1].m_data_size = 4;
+    entries[1].m_offset = offset;
+    entries[1].m_flags = 1;
+
+    auto master = reinterpret_cast<EAT::MASTER<T_SIZE> *>(image);
+    assert(!master->is_valid());
+    assert(master->upgrade());
+    assert(master->is_intact());
+    assert(master->num_entries() == 2);
+    assert(master->handle_capacity() == 0);
+
+    // an unsorted table passes the header check only
+    std::swap(master->get_entries()[0], master->get_entries()[1]);
+    assert(master->is_valid() && !master->is_intact());
+    assert(!master->upgrade());
+    std::swap(master->get_entries()[0], master->get_entries()[1]);
+    assert(master->is_intact());
+    auto entries2 = master->get_entries();
+    assert(strcmp(reinterpret_cast<char *>(master->ptr_from_offset(entries2[1].m_offset)), "ABC") == 0);
+    assert(strcmp(reinterpret_cast<char *>(master->ptr_from_offset(entries2[0].m_offset)), "DE") == 0);
+    assert(master->malloc_(10) != NULL);
+
+    // make an image of version 4 with a handle by hand
+    std::memset(image, 0, t_total_size);
+    std::memcpy(head->m_magic, "EAT\4", 4);
+    head->m_flags = sizeof(T_SIZE);
+    head->m_total_size = t_total_size;
+    offset = T_SIZE(sizeof(head_type));
+    auto table = reinterpret_cast<T_SIZE *>(image + offset); // capacity 1
+    table[2] = T_SIZE(offset + 4 * sizeof(T_SIZE));
+    table[0] = 1;
+    std::memcpy(image + table[2], "FGH", 4);
+    reinterpret_cast<T_SIZE *>(image + table[2] + 4)[0] = 1; // the mark of handle 1
+    head->m_handles = offset;
+    head->m_boudary_1 = T_SIZE(table[2] + 4 + sizeof(T_SIZE));
+    head->m_boudary_2 = T_SIZE(t_total_size - 2 * sizeof(entry_type));
+    entries = reinterpret_cast<entry_type *>(image + head->m_boudary_2);
+    entries[0].m_data_size = T_SIZE(4 + sizeof(T_SIZE));
+    entries[0].m_offset = table[2];
+    entries[0].m_flags = 1 | (2 << 4);
+    entries[1].m_data_size = T_SIZE(4 * sizeof(T_SIZE));
+    entries[1].m_offset = offset;
+    entries[1].m_flags = 1 | (2 << 4);
+
+    // the unsorted copy is refused, and stays refused
+    auto broken_image = reinterpret_cast<char *>(malloc(t_total_size));
+    std::memcpy(broken_image, image, t_total_size);
+    auto broken_entries = reinterpret_cast<entry_type *>(broken_image + head->m_boudary_2);
+    std::swap(broken_entries[0], broken_entries[1]);
+    auto broken = reinterpret_cast<EAT::MASTER<T_SIZE> *>(broken_image);
+    assert(!broken->upgrade());
+    assert(!broken->is_valid());
+    assert(!broken->upgrade());
+    free(broken_image);
+
+    // a file of version 4 is upgraded only if asked to
+    const char *path = "eat-test.tmp";
+    FILE *fp = fopen(path, "wb");
+    assert(fp && fwrite(image, t_total_size, 1, fp) == 1);
+    fclose(fp);
+    assert(EAT::open_master_file<T_SIZE>(path, EAT::FILE_READ_ONLY) == NULL);
+    assert(EAT::open_master_file<T_SIZE>(path) == NULL);
+    auto mapped = EAT::open_master_file<T_SIZE>(path, EAT::FILE_PRIVATE);
+    assert(mapped && mapped->is_intact());
+    EAT::close_master_file(mapped);
+    assert(EAT::open_master_file<T_SIZE>(path) == NULL); // the file is kept
+    mapped = EAT::open_master_file<T_SIZE>(path, EAT::FILE_UPGRADE);
+    assert(mapped && mapped->is_intact());
+    EAT::close_master_file(mapped);
+    mapped = EAT::open_master_file<T_SIZE>(path);
+    assert(mapped && strcmp(reinterpret_cast<char *>(mapped->deref(1)), "FGH") == 0);
+    EAT::close_master_file(mapped);
+    remove(path);
+
+    assert(!master->is_valid());
+    assert(master->upgrade());
+    assert(master->is_intact());
+    assert(master->num_entries() == 2);
+    assert(master->table_size() == 2 * sizeof(typename EAT::MASTER<T_SIZE>::entry_type));
+    assert(master->get_entries()[0].alignment() == 4);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(1)), "FGH") == 0);
+    assert(master->malloc_(10) != NULL);
+
+    free(image);
+}
+
+// the table is sorted, no valid blocks overlap and block #id is filled by
+// the byte id and has sizes[id] bytes
+template <typename T_SIZE>
+bool intact_blocks(const EAT::MASTER<T_SIZE> *master, const std::vector<T_SIZE>& sizes)
+{
+    if (!master->is_intact())
+        return false;
+    std::vector<int> found(sizes.size(), 0);
+    auto entries = master->get_entries();
+    for (auto i = master->next_entry(0); i < master->num_entries(); i = master->next_entry(T_SIZE(i + 1)))
+    {
+        if (size_t(entries[i].m_offset) + entries[i].m_data_size > master->entry_end(i))
+            return false; // overlapped
+        auto p = reinterpret_cast<const unsigned char *>(master->ptr_from_offset(entries[i].m_offset));
+        size_t id = p[0];
+        if (id >= sizes.size() || sizes[id] != entries[i].m_data_size || found[id]++)
+            return false;
+        for (T_SIZE k = 0; k < entries[i].m_data_size; ++k)
+        {
+            if (p[k] != id)
+                return false;
+        }
+    }
+    for (size_t id = 0; id < sizes.size(); ++id)
+    {
+        if (sizes[id] && !found[id])
+            return false;
+    }
+    return true;
+}
+
+// the block filled by the byte id, or NULL
+template <typename T_SIZE>
+void *find_block(EAT::MASTER<T_SIZE> *master, size_t id)
+{
+    auto entries = master->get_entries();
+    for (auto i = master->next_entry(0); i < master->num_entries(); i = master->next_entry(T_SIZE(i + 1)))
+    {
+        auto p = master->ptr_from_offset(entries[i].m_offset);
+        if (*reinterpret_cast<unsigned char *>(p) == id)
+            return p;
+    }
+    return NULL;
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test8(void)
+{
+    printf("## test8(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef typename EAT::MASTER<T_SIZE>::handle_type handle_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    auto master2 = EAT::create_master<T_SIZE>(t_total_size);
+    assert(master->compact_step(1));
+
+    // make a fragmented master
+    handle_type handles[40];
+    for (int i = 0; i < 40; ++i)
+    {
+        handles[i] = master->alloc_handle(T_SIZE(i % 7 + 1), T_SIZE(i % 3 ? 1 : 4));
+        assert(handles[i] != 0);
+        std::memset(master->deref(handles[i]), 'A' + i, i % 7 + 1);
+    }
+    for (int i = 0; i < 40; ++i)
+    {
+        if (i % 5 == 1 || i % 5 == 2 || i == 39)
+        {
+            master->free_handle(handles[i]);
+            handles[i] = 0;
+        }
+    }
+    master->aligned_malloc_(2, 16);
+    master->free_(master->strdup_("free"));
+    master->strdup_("used");
+
+    // compare with the one-shot compaction
+    master2->copy(*master);
+    master2->compact();
+
+    int steps = 0;
+    while (!master->compact_step(8))
+    {
+        ++steps;
+        assert(master->is_valid());
+        for (int i = 0; i < 40; ++i)
+        {
+            if (!handles[i])
+                continue;
+            auto p = reinterpret_cast<char *>(master->deref(handles[i]));
+            assert(p[0] == 'A' + i && p[i % 7] == 'A' + i);
+        }
+    }
+    assert(steps > 2);
+    assert(master->data_area_size() == master2->data_area_size());
+    assert(master->num_entries() == master2->num_entries());
+    assert(master->compact_step(8));
+
+    // compaction after some frees
+    master->free_handle(handles[10]);
+    assert(!master->compact_step(1));
+    while (!master->compact_step(1))
+        ;
+    assert(memcmp(master->deref(handles[13]), "NNNNNNN", 7) == 0);
+
+    EAT::destroy_master(master2);
+    EAT::destroy_master(master);
+
+    // an aligned block that cannot move leaves no hole at its end
+    master = EAT::create_master<T_SIZE>(t_total_size);
+    std::vector<T_SIZE> sizes(6, 0);
+    void *ptrs[6];
+    for (int id = 1; id <= 5; ++id)
+    {
+        sizes[id] = T_SIZE(id <= 2 ? 4 : 8);
+        ptrs[id] = (id == 3) ? master->aligned_malloc_(8, 16) : master->malloc_(sizes[id]);
+        std::memset(ptrs[id], id, sizes[id]);
+    }
+    master->free_(ptrs[1]);
+    master->free_(ptrs[2]);
+    sizes[1] = sizes[2] = 0;
+    master->compact_step(1);
+    assert(intact_blocks(master, sizes));
+    assert(master->_msize_(find_block(master, 4)) == 8);
+    auto ptr = master->realloc_(find_block(master, 4), 16);
+    assert(ptr && memcmp(ptr, "\4\4\4\4\4\4\4\4", 8) == 0);
+    EAT::destroy_master(master);
+
+    // growing in place crosses the suspended compaction
+    master = EAT::create_master<T_SIZE>(t_total_size);
+    sizes.assign(5, 0);
+    for (int id = 1; id <= 4; ++id)
+    {
+        sizes[id] = 16;
+        std::memset(master->malloc_(16), id, 16);
+    }
+    master->free_(find_block(master, 2));
+    sizes[2] = 0;
+    master->compact_step(1);
+    ptr = master->realloc_(find_block(master, 3), 24);
+    assert(ptr != NULL);
+    std::memset(ptr, 3, 24);
+    sizes[3] = 24;
+    while (!master->compact_step(1))
+        assert(intact_blocks(master, sizes));
+    assert(intact_blocks(master, sizes));
+    EAT::destroy_master(master);
+
+    // random operations on aligned blocks with a suspended compaction
+    master = EAT::create_master<T_SIZE>(t_total_size);
+    sizes.assign(64, 0);
+    srand(8);
+    for (int n = 0; n < 4000; ++n)
+    {
+        auto id = size_t(1 + rand() % 63);
+        auto siz = T_SIZE(1 + rand() % 24);
+        if (!sizes[id])
+        {
+            ptr = master->aligned_malloc_(siz, T_SIZE(1 << rand() % 5));
+            if (ptr)
+            {
+                std::memset(ptr, int(id), siz);
+                sizes[id] = siz;
+            }
+        }
+        else if (rand() % 2)
+        {
+            ptr = master->realloc_(find_block(master, id), siz);
+            if (ptr)
+            {
+                auto p = reinterpret_cast<unsigned char *>(ptr);
+                for (T_SIZE k = 0; k < siz && k < sizes[id]; ++k)
+                    assert(p[k] == id);
+                std::memset(ptr, int(id), siz);
+                sizes[id] = siz;
+            }
+        }
+        else
+        {
+            master->free_(find_block(master, id));
+            sizes[id] = 0;
+        }
+        assert(intact_blocks(master, sizes));
+        if (rand() % 2)
+        {
+            master->compact_step(size_t(1 + rand() % 32));
+            assert(intact_blocks(master, sizes));
+        }
+    }
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test9(void)
+{
+    printf("## test9(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    const char *path = "eat-test.tmp";
+
+    // create a file
+    auto master = EAT::create_master_file<T_SIZE>(path, t_total_size);
+    assert(master != NULL);
+    auto h1 = master->alloc_handle(4);
+    std::memcpy(master->deref(h1), "ABC", 4);
+    master->strdup_("DEF");
+    assert(EAT::sync_master(master));
+    EAT::close_master_file(master);
+
+    // open it without initializing
+    master = EAT::open_master_file<T_SIZE>(path, EAT::FILE_READ_ONLY);
+    assert(master != NULL);
+    assert(master->num_entries() == 3);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(h1)), "ABC") == 0);
+    EAT::close_master_file(master);
+
+    // modify it privately
+    master = EAT::open_master_file<T_SIZE>(path, EAT::FILE_PRIVATE);
+    assert(master != NULL);
+    master->free_handle(h1);
+    EAT::close_master_file(master);
+
+    // modify it
+    master = EAT::open_master_file<T_SIZE>(path);
+    assert(master != NULL);
+    assert(master->num_entries() == 3);
+    master->strdup_("GHI");
+    EAT::close_master_file(master);
+
+    master = EAT::open_master_file<T_SIZE>(path);
+    assert(master->num_entries() == 4);
+    EAT::close_master_file(master);
+
+    // an image in memory is not initialized either
+    auto image = EAT::create_master<T_SIZE>(t_total_size);
+    image->strdup_("JKL");
+    assert(EAT::master_from_image<T_SIZE>(image, t_total_size) == image);
+    assert(image->num_entries() == 1);
+    std::memset(static_cast<void *>(image), 0, t_total_size);
+    assert(EAT::master_from_image<T_SIZE>(image) == NULL);
+    assert(EAT::master_from_image<T_SIZE>(image, t_total_size) == image);
+    assert(image->empty());
+    EAT::destroy_master(image);
+
+    assert(EAT::open_master_file<T_SIZE>("eat-test.nonexistent") == NULL);
+    remove(path);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test10(void)
+{
+    printf("## test10(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    // resize a master on the heap
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    auto h1 = master->alloc_handle(4);
+    std::memcpy(master->deref(h1), "ABC", 4);
+    master = EAT::resize_master(master, t_total_size * 2);
+    assert(master && master->total_size() == t_total_size * 2);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(h1)), "ABC") == 0);
+    master = EAT::resize_master(master, t_total_size / 2);
+    assert(master && master->total_size() == t_total_size / 2);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(h1)), "ABC") == 0);
+    assert(EAT::resize_master(master, master->head_size()) == NULL);
+    EAT::destroy_master(master);
+
+    // resize a master file
+    const char *path = "eat-test.tmp";
+    master = EAT::create_master_file<T_SIZE>(path, t_total_size);
+    h1 = master->alloc_handle(4);
+    std::memcpy(master->deref(h1), "DEF", 4);
+    master = EAT::resize_master_file(master, path, t_total_size * 2);
+    assert(master && master->total_size() == t_total_size * 2);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(h1)), "DEF") == 0);
+    master = EAT::resize_master_file(master, path, t_total_size / 2);
+    assert(master && master->total_size() == t_total_size / 2);
+    EAT::close_master_file(master);
+    master = EAT::open_master_file<T_SIZE>(path, EAT::FILE_READ_ONLY);
+    assert(master && master->total_size() == t_total_size / 2);
+    assert(strcmp(reinterpret_cast<char *>(master->deref(h1)), "DEF") == 0);
+    EAT::close_master_file(master);
+    remove(path);
+
+    // grow a reserved master in place
+    const size_t reserved_size = size_t(t_total_size) * 64;
+    master = EAT::reserve_master<T_SIZE>(reserved_size, t_total_size);
+    assert(master != NULL);
+    char *psz = master->strdup_("GHI");
+    size_t total = 0;
+    while (void *ptr = EAT::grow_malloc(master, 100))
+    {
+        std::memset(ptr, 0xFF, 100);
+        total += 100;
+    }
+    assert(total > reserved_size / 2);
+    assert(master->total_size() == reserved_size);
+    assert(master->free_area_size() < 100 + master->entry_size());
+    assert(strcmp(psz, "GHI") == 0);
+    assert(EAT::commit_master(master, t_total_size * 2) == false);
+    master->clear();
+    assert(EAT::commit_master(master, t_total_size * 2));
+    assert(master->total_size() == t_total_size * 2);
+    EAT::release_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test11(void)
+{
+    printf("## test11(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    EAT::SHARED<T_SIZE> shared(t_total_size);
+
+    // free a block of another thread
+    {
+        EAT::LOCAL<T_SIZE> local1(shared, t_total_size), local2(shared, t_total_size);
+        void *p1 = local1.malloc_(10);
+        void *p2 = local2.malloc_(20);
+        void *p3 = local1.malloc_(30);
+        assert(shared.owner_of(p1) == &local1);
+        assert(shared.owner_of(p2) == &local2);
+        assert(shared.owner_of(&shared) == NULL);
+        local2.free_(p1); // queued
+        assert(local1.master()->num_entries() == 2);
+        local1.free_(p3); // drains the queue
+        assert(local1.master()->empty());
+
+        // publish
+        auto h2 = local2.master()->alloc_handle(4);
+        std::memcpy(local2.master()->deref(h2), "ABC", 4);
+        T_SIZE diff, handle_base;
+        assert(local2.publish(&diff, &handle_base));
+        assert(local2.master()->empty());
+        auto master = shared.master();
+        assert(master->num_entries() == 3);
+        assert(master->_msize_(master->ptr_from_offset(T_SIZE(local2.master()->head_size() + diff))) == 20);
+        assert(strcmp(reinterpret_cast<char *>(master->deref(T_SIZE(h2 + handle_base))), "ABC") == 0);
+        local1.free_(master->ptr_from_offset(T_SIZE(local2.master()->head_size() + diff)));
+        assert(!master->get_entries()[2].is_valid());
+    }
+
+    // publish from the threads
+    const int num_threads = 4;
+    T_SIZE handles[num_threads];
+    std::vector<std::thread> threads;
+    for (int k = 0; k < num_threads; ++k)
+    {
+        threads.push_back(std::thread([&shared, &handles, k]() {
+            EAT::LOCAL<T_SIZE> local(shared, t_total_size / 2);
+            for (int i = 0; i < 10; ++i)
+            {
+                void *ptr = local.malloc_(8);
+                assert(ptr != NULL);
+                if (i % 2)
+                    local.free_(ptr);
+            }
+            auto h = local.master()->alloc_handle(2);
+            reinterpret_cast<char *>(local.master()->deref(h))[0] = char('A' + k);
+            reinterpret_cast<char *>(local.master()->deref(h))[1] = 0;
+            T_SIZE handle_base;
+            bool ok = local.publish(NULL, &handle_base);
+            assert(ok);
+            (void)ok;
+            handles[k] = T_SIZE(h + handle_base);
+        }));
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(shared.mutex());
+    auto master = shared.master();
+    assert(master->is_valid());
+    for (int k = 0; k < num_threads; ++k)
+    {
+        assert(*reinterpret_cast<char *>(master->deref(handles[k])) == char('A' + k));
+    }
+
+    // no shared master
+    {
+        EAT::SHARED<T_SIZE> none(size_t(T_SIZE(-1)) + 1); // too large
+        assert(none.master() == NULL);
+        EAT::LOCAL<T_SIZE> local(none, t_total_size);
+        assert(local.malloc_(10) != NULL);
+        assert(!local.publish());
+    }
+
+    // no sub-master
+    {
+        EAT::LOCAL<T_SIZE> local(shared, size_t(T_SIZE(-1)) + 1); // too large
+        assert(local.master() == NULL);
+        assert(local.malloc_(10) == NULL && local.aligned_malloc_(10, 8) == NULL);
+        assert(local.realloc_(NULL, 10) == NULL);
+        assert(!local.owns(&local));
+        local.drain();
+        assert(!local.publish());
+    }
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test12(void)
+{
+    printf("## test12(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    master->strdup_("ABC");
+
+    const int num_threads = 8, count = 20;
+    {
+        EAT::CONCURRENT<T_SIZE> concurrent(master);
+        std::vector<std::thread> threads;
+        for (int k = 0; k < num_threads; ++k)
+        {
+            threads.push_back(std::thread([&concurrent, k]() {
+                for (int i = 0; i < count; ++i)
+                {
+                    auto ptr = reinterpret_cast<char *>(concurrent.aligned_malloc_(2, 2));
+                    assert(ptr != NULL);
+                    ptr[0] = char(k);
+                    ptr[1] = char(i);
+                }
+            }));
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // every block is found and sorted
+    assert(master->is_valid());
+    assert(master->num_entries() == num_threads * count + 1);
+    int counts[num_threads] = { 0 };
+    auto entries = master->get_entries();
+    for (T_SIZE i = 0; i < master->num_entries() - 1; ++i)
+    {
+        assert(entries[i].m_offset > entries[i + 1].m_offset);
+        assert(entries[i].m_offset % 2 == 0);
+        auto ptr = reinterpret_cast<char *>(master->ptr_from_offset(entries[i].m_offset));
+        assert(master->fetch_entry(ptr) == &entries[i]);
+        ++counts[int(ptr[0])];
+    }
+    for (int k = 0; k < num_threads; ++k)
+    {
+        assert(counts[k] == count);
+    }
+
+    // the master is used after detach
+    {
+        EAT::CONCURRENT<T_SIZE> concurrent(master);
+        assert(concurrent.malloc_(4) != NULL);
+        concurrent.detach();
+        assert(master->malloc_(10) != NULL && master->malloc_(10) != NULL);
+    }
+    assert(master->is_valid());
+    assert(master->num_entries() == num_threads * count + 4);
+
+    // no room
+    {
+        EAT::CONCURRENT<T_SIZE> concurrent(master);
+        assert(concurrent.malloc_(t_total_size) == NULL);
+        while (concurrent.malloc_(1))
+            ;
+    }
+    assert(master->is_valid());
+    assert(master->free_area_size() < master->entry_size() + master->alignment());
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test13(void)
+{
+    printf("## test13(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    auto p0 = master->strdup_("ABC");
+
+    // allocate at once
+    const T_SIZE sizes[] = { 10, 0, 20, 30, 40 };
+    void *ptrs[5];
+    assert(master->malloc_batch(sizes, 5, ptrs));
+    assert(master->num_entries() == 5);
+    assert(ptrs[1] == NULL);
+    for (int i = 0; i < 5; ++i)
+    {
+        if (sizes[i])
+            assert(master->_msize_(ptrs[i]) == sizes[i]);
+    }
+    assert(master->fetch_entry(ptrs[4]) == &master->get_entries()[0]);
+
+    // free at once: a hole and the top
+    void *frees[] = { ptrs[2], ptrs[4], NULL, ptrs[4], ptrs[3] };
+    master->free_batch(frees, 5);
+    assert(master->num_entries() == 2);
+    void *q = ptrs[0];
+    assert(master->_msize_(q) == 10);
+    assert(master->data_area_size() == master->offset_from_ptr(q) + 10 - master->head_size());
+
+    // holes in the middle are coalesced
+    assert(master->malloc_batch(sizes, 5, ptrs));
+    void *frees2[] = { ptrs[3], ptrs[0], ptrs[2] };
+    master->free_batch(frees2, 3);
+    assert(master->num_entries() == 4);
+    assert(!master->get_entries()[1].is_valid());
+    assert(master->_msize_(ptrs[4]) == 40);
+
+    // fails as a whole
+    T_SIZE big[] = { 20, T_SIZE(master->free_area_size()) };
+    assert(!master->malloc_batch(big, 2, ptrs));
+    assert(master->num_entries() == 4);
+    T_SIZE big3[] = { 20, 30, T_SIZE(master->free_area_size()) };
+    assert(!master->malloc_batch(big3, 3, ptrs));
+    assert(master->num_entries() == 4);
+    assert(ptrs[0] == NULL && ptrs[1] == NULL && ptrs[2] == NULL);
+
+    // the holes are reused if the free area is too small
+    void *n4 = ptrs[4];
+    void *rest = master->malloc_(T_SIZE(master->free_area_size() - master->entry_size()));
+    assert(rest != NULL);
+    assert(master->malloc_batch(big, 1, ptrs));
+    assert(ptrs[0] > q && ptrs[0] < n4);
+
+    void *all[] = { ptrs[0], rest, p0, q, n4 };
+    master->free_batch(all, 5);
+    assert(master->empty());
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test14(void)
+{
+    printf("## test14(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    auto p1 = master->strdup_("ABC");
+    auto used = master->used_area_size();
+
+    // nested marks
+    auto mark1 = master->mark();
+    master->malloc_(10);
+    auto mark2 = master->mark();
+    auto p2 = master->malloc_(20);
+    master->malloc_(30);
+    master->free_(p2);
+    assert(master->release(mark2));
+    assert(master->num_entries() == 2);
+    assert(master->release(mark1));
+    assert(master->used_area_size() == used);
+    assert(strcmp(p1, "ABC") == 0);
+
+    // the scope
+    {
+        EAT::SCOPE<T_SIZE> scope(master);
+        master->strdup_("DEF");
+        master->strdup_("GHI");
+    }
+    assert(master->used_area_size() == used);
+
+    // a reused hole cannot be released
+    auto p3 = master->malloc_(40);
+    master->strdup_("JKL");
+    master->free_(p3);
+    {
+        EAT::SCOPE<T_SIZE> scope(master);
+        auto p4 = master->reuse_hole(40);
+        assert(p4 == p3);
+        master->malloc_(50);
+        assert(!scope.release());
+    }
+    assert(master->num_entries() == 4);
+    assert(master->fetch_entry(p3) != NULL);
+
+    // a block below the mark after freeing the top
+    master->free_(p3);
+    auto top = master->get_entries()[0].m_offset;
+    auto mark3 = master->mark();
+    master->free_(master->ptr_from_offset(top));
+    master->malloc_(5);
+    assert(!master->release(mark3));
+
+    // a block freed below the mark is kept freed
+    auto data_size = master->data_area_size();
+    auto mark4 = master->mark();
+    master->malloc_(5);
+    master->free_(p1);
+    assert(master->release(mark4));
+    assert(master->data_area_size() == data_size);
+    assert(!master->fetch_entry(p1) || !master->fetch_entry(p1)->is_valid());
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test15(void)
+{
+    printf("## test15(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::ENTRY<T_SIZE> entry_type;
+    std::vector<entry_type> entries;
+    srand(1);
+    for (int i = 0; i < 150; ++i)
+    {
+        T_SIZE flags = T_SIZE((rand() % 4 ? entry_type::FLAG_VALID : 0) | (rand() % 2 ? 0x30 : 0));
+        entries.push_back(entry_type(T_SIZE(rand()), T_SIZE(rand()), flags));
+    }
+
+    // every kernel agrees with the scalar code
+    auto& level = EAT::detail::simd_level();
+    auto detected = level;
+    for (int l = EAT::detail::SIMD_NONE; l <= detected; ++l)
+    {
+        level = l;
+        for (size_t first = 0; first < entries.size(); first += 7)
+        {
+            for (size_t last = first; last <= entries.size(); last += 3)
+            {
+                for (int set = 0; set <= 1; ++set)
+                {
+                    auto ptr = &entries[0];
+                    assert(EAT::detail::find_flag(ptr, first, last, 1, set != 0) ==
+                           EAT::detail::find_flag_scalar(ptr, first, last, 1, set != 0));
+                    assert(EAT::detail::rfind_flag(ptr, first, last, 1, set != 0) ==
+                           EAT::detail::rfind_flag_scalar(ptr, first, last, 1, set != 0));
+                }
+            }
+        }
+    }
+
+    // the master uses them
+    for (int l = EAT::detail::SIMD_NONE; l <= detected; ++l)
+    {
+        level = l;
+        auto master = EAT::create_master<T_SIZE>(t_total_size);
+        void *ptrs[100];
+        for (int i = 0; i < 100; ++i)
+        {
+            ptrs[i] = master->malloc_(T_SIZE(1 + i % 3));
+        }
+        for (int i = 0; i < 100; i += 3)
+        {
+            master->free_(ptrs[i]);
+        }
+        int count = 0;
+        auto fn = [&count](entry_type&) { ++count; return true; };
+        master->foreach_entry(fn);
+        assert(count == 66);
+        assert(master->next_entry(0, false) < master->num_entries());
+        assert(master->prev_entry(master->num_entries(), false) == master->num_entries() - 1);
+        master->compact();
+        assert(master->num_entries() == 66);
+        assert(master->next_entry(0, false) == master->num_entries());
+        EAT::destroy_master(master);
+    }
+    level = detected;
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test16(void)
+{
+    printf("## test16(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    const char *path = "eat-test.tmp";
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    typename EAT::MASTER<T_SIZE>::handle_type handles[10];
+    void *ptrs[10];
+    for (int i = 0; i < 10; ++i)
+    {
+        handles[i] = master->alloc_handle(T_SIZE(3 + i), T_SIZE(i % 2 ? 1 : 8));
+        std::memset(master->deref(handles[i]), 'A' + i, 3 + i);
+        ptrs[i] = master->strdup_("XYZ");
+    }
+    for (int i = 0; i < 10; i += 3)
+    {
+        master->free_handle(handles[i]);
+        master->free_(ptrs[i]);
+    }
+
+    // as it is; the free area is not written
+    size_t written = 0;
+    auto count_fn = [&written](const void *, size_t size) { written += size; return true; };
+    assert(EAT::write_master(master, count_fn));
+    assert(written == master->used_area_size());
+    assert(EAT::save_master(master, path));
+    auto loaded = EAT::load_master<T_SIZE>(path);
+    assert(loaded != NULL && loaded->is_intact());
+    auto b2 = t_total_size - master->table_size();
+    assert(memcmp(loaded, master, master->head_size() + master->data_area_size()) == 0);
+    assert(memcmp(loaded->get_entries(), master->get_entries(), t_total_size - b2) == 0);
+    EAT::destroy_master(loaded);
+
+    // compact
+    written = 0;
+    assert(EAT::write_master(master, count_fn, true));
+    assert(written < master->used_area_size());
+    assert(EAT::save_master(master, path, true));
+    loaded = EAT::load_master<T_SIZE>(path);
+    assert(loaded != NULL && loaded->is_intact());
+    master->compact();
+    assert(loaded->used_area_size() == master->used_area_size());
+    assert(loaded->num_entries() == master->num_entries());
+    for (int i = 0; i < 10; ++i)
+    {
+        if (i % 3 == 0)
+            continue;
+        assert(loaded->deref(handles[i]) != NULL);
+        assert(loaded->offset_from_ptr(loaded->deref(handles[i])) % (i % 2 ? 1 : 8) == 0);
+        assert(memcmp(loaded->deref(handles[i]), master->deref(handles[i]), 3 + i) == 0);
+    }
+    assert(loaded->alloc_handle(4) != 0);
+    EAT::destroy_master(loaded);
+
+    // broken
+    FILE *fp = fopen(path, "wb");
+    fwrite(master, 1, master->head_size() + 1, fp);
+    fclose(fp);
+    assert(EAT::load_master<T_SIZE>(path) == NULL);
+    assert(EAT::load_master<T_SIZE>("eat-test.nonexistent") == NULL);
+    remove(path);
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE>
+bool same_images(const EAT::MASTER<T_SIZE> *a, const EAT::MASTER<T_SIZE> *b)
+{
+    if (a->total_size() != b->total_size() || a->used_area_size() != b->used_area_size())
+        return false;
+    if (memcmp(a, b, a->head_size()) != 0)
+        return false;
+    if (memcmp(a->get_entries(), b->get_entries(), a->table_size()) != 0)
+        return false;
+    auto entries = a->get_entries();
+    for (auto i = a->next_entry(0); i < a->num_entries(); i = a->next_entry(T_SIZE(i + 1)))
+    {
+        if (memcmp(a->ptr_from_offset(entries[i].m_offset), b->ptr_from_offset(entries[i].m_offset),
+                   entries[i].m_data_size) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test17(void)
+{
+    printf("## test17(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    std::vector<char> base, delta;
+    auto base_fn = [&base](const void *ptr, size_t size) {
+        base.insert(base.end(), (const char *)ptr, (const char *)ptr + size);
+        return true;
+    };
+    auto delta_fn = [&delta](const void *ptr, size_t size) {
+        delta.insert(delta.end(), (const char *)ptr, (const char *)ptr + size);
+        return true;
+    };
+    const std::vector<char> *source = &base;
+    size_t pos = 0;
+    auto read_fn = [&source, &pos](void *ptr, size_t size) {
+        if (pos + size > source->size())
+            return false;
+        memcpy(ptr, &(*source)[pos], size);
+        pos += size;
+        return true;
+    };
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    assert(!master->is_tracking());
+    assert(!EAT::write_delta(master, delta_fn));
+    assert(master->track_dirty(64));
+    assert(master->is_tracking());
+    void *ptrs[20];
+    for (int i = 0; i < 20; ++i)
+    {
+        ptrs[i] = master->malloc_(T_SIZE(40 + i));
+        memset(ptrs[i], 'a' + i, 40 + i);
+    }
+    auto h = master->alloc_handle(16);
+    memset(master->deref(h), 'H', 16);
+
+    // the base
+    assert(EAT::write_master(master, base_fn));
+    master->clear_dirty();
+    auto target = EAT::read_master<T_SIZE>(read_fn);
+    assert(target != NULL);
+
+    // a small change is a small delta
+    memset(ptrs[3], 'X', 8);
+    master->touch(ptrs[3]);
+    assert(EAT::write_delta(master, delta_fn));
+    assert(delta.size() < base.size() / 4);
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && same_images(master, target));
+
+    // a hole in the middle
+    delta.clear();
+    master->free_(ptrs[10]);
+    assert(EAT::write_delta(master, delta_fn));
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && same_images(master, target));
+
+    // free_batch moves the entries down the table
+    delta.clear();
+    void *batch[3] = { ptrs[11], ptrs[12], ptrs[14] };
+    master->free_batch(batch, 3);
+    auto hole = master->fetch_entry(ptrs[10]);
+    assert(hole != NULL && !hole->is_valid());
+    assert(hole->m_data_size == T_SIZE(40 + 10 + 40 + 11 + 40 + 12));
+    assert(EAT::write_delta(master, delta_fn));
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && same_images(master, target));
+
+    // the library marks its own changes
+    delta.clear();
+    master->free_(ptrs[5]);
+    master->free_(ptrs[6]);
+    ptrs[5] = master->realloc_(ptrs[2], 30);
+    ptrs[2] = master->malloc_(20);
+    memset(ptrs[2], 'Y', 20);
+    master->free_(ptrs[19]);
+    master->realloc_handle(h, 100);
+    auto h2 = master->alloc_handle(8);
+    memset(master->deref(h2), 'I', 8);
+    master->compact_step(50);
+    assert(EAT::write_delta(master, delta_fn));
+    master->compact();
+    assert(EAT::write_delta(master, delta_fn));
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL);
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && pos == delta.size());
+    assert(same_images(master, target));
+    assert(memcmp(target->deref(h2), "IIIIIIII", 8) == 0);
+
+    // growing the image
+    delta.clear();
+    master = EAT::resize_master(master, t_total_size * 2);
+    assert(master->track_dirty(64));
+    ptrs[0] = master->malloc_(T_SIZE(t_total_size / 2));
+    memset(ptrs[0], 'Z', t_total_size / 2);
+    assert(EAT::write_delta(master, delta_fn));
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && same_images(master, target));
+
+    // broken
+    delta.resize(delta.size() - 1);
+    source = &delta;
+    pos = 0;
+    assert(EAT::read_delta(target, read_fn) == NULL);
+
+    // the delta log
+    const char *base_path = "eat-test.tmp", *delta_path = "eat-test-delta.tmp";
+    remove(delta_path);
+    master->untrack_dirty();
+    assert(!master->is_tracking());
+    assert(master->track_dirty(128));
+    assert(EAT::save_master(master, base_path));
+    master->clear_dirty();
+    for (int i = 0; i < 3; ++i)
+    {
+        ptrs[i] = master->strdup_("delta");
+        assert(EAT::save_delta(master, delta_path));
+    }
+    target = EAT::load_master<T_SIZE>(base_path);
+    assert(target != NULL);
+    target = EAT::apply_delta(target, delta_path);
+    assert(target != NULL && same_images(master, target));
+    EAT::destroy_master(target);
+    remove(base_path);
+    remove(delta_path);
+
+    // compact moves the dirty map itself
+    EAT::destroy_master(master);
+    master = EAT::create_master<T_SIZE>(t_total_size);
+    void *first = master->malloc_(8);
+    assert(master->track_dirty(64));
+    assert(master->strdup_("moved") != NULL);
+    base.clear();
+    assert(EAT::write_master(master, base_fn));
+    master->clear_dirty();
+    auto map_offset = master->offset_from_ptr(master->get_dirty_map());
+    master->free_(first);
+    master->compact();
+    assert(master->offset_from_ptr(master->get_dirty_map()) < map_offset);
+    delta.clear();
+    assert(EAT::write_delta(master, delta_fn));
+    source = &base;
+    pos = 0;
+    target = EAT::read_master<T_SIZE>(read_fn);
+    assert(target != NULL);
+    source = &delta;
+    pos = 0;
+    target = EAT::read_delta(target, read_fn);
+    assert(target != NULL && same_images(master, target));
+    assert(memcmp(target->get_dirty_map(), master->get_dirty_map(), 3 * sizeof(T_SIZE)) == 0);
+    EAT::destroy_master(target);
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test18(void)
+{
+    printf("## test18(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    master_type *srcs[4];
+    typename master_type::handle_type handles[4];
+    T_SIZE holes[4];
+    for (int k = 0; k < 4; ++k)
+    {
+        srcs[k] = EAT::create_master<T_SIZE>(400);
+        if (k == 3)
+            break; // empty
+        void *ptrs[5];
+        for (int i = 0; i < 5; ++i)
+        {
+            ptrs[i] = srcs[k]->aligned_malloc_(T_SIZE(5 + i), T_SIZE(k == 1 ? 16 : 1));
+            memset(ptrs[i], 'a' + 5 * k + i, 5 + i);
+        }
+        holes[k] = srcs[k]->offset_from_ptr(ptrs[2]);
+        srcs[k]->free_(ptrs[2]);
+        handles[k] = 0;
+        if (k != 1)
+        {
+            handles[k] = srcs[k]->alloc_handle(6);
+            memset(srcs[k]->deref(handles[k]), 'A' + k, 6);
+        }
+    }
+
+    for (int drop = 0; drop < 2; ++drop)
+    {
+        auto master = EAT::create_master<T_SIZE>(t_total_size);
+        auto h = master->alloc_handle(4);
+        memset(master->deref(h), 'M', 4);
+        assert(!master->merge_many(srcs, 4)); // no room
+
+        master = EAT::grow_for_merge(master, srcs, 4);
+        assert(master != NULL);
+        T_SIZE diffs[4], bases[4];
+        if (drop)
+        {
+            EAT::PARALLEL_RUNNER runner(4);
+            assert(master->merge_many(srcs, 4, runner, diffs, bases, true));
+        }
+        else
+        {
+            assert(master->merge_many(srcs, 4, diffs, bases));
+        }
+
+        assert(memcmp(master->deref(h), "MMMM", 4) == 0);
+        for (int k = 0; k < 4; ++k)
+        {
+            auto entries = srcs[k]->get_entries();
+            for (auto i = srcs[k]->next_entry(0); i < srcs[k]->num_entries();
+                 i = srcs[k]->next_entry(T_SIZE(i + 1)))
+            {
+                auto offset = T_SIZE(entries[i].m_offset + diffs[k]);
+                auto index = master->find_entry_index(offset);
+                assert(index < master->num_entries());
+                assert(offset % entries[i].alignment() == 0);
+                if (handles[k] && srcs[k]->get_handle_table() == srcs[k]->ptr_from_offset(entries[i].m_offset))
+                {
+                    assert(!master->get_entries()[index].is_valid()); // the copy was freed
+                    continue;
+                }
+                assert(master->get_entries()[index].is_valid());
+                auto siz = entries[i].m_data_size;
+                if (handles[k] && srcs[k]->handle_offset(handles[k]) == entries[i].m_offset)
+                    siz -= sizeof(T_SIZE); // the handle mark is renumbered
+                assert(memcmp(master->ptr_from_offset(offset), srcs[k]->ptr_from_offset(entries[i].m_offset),
+                              siz) == 0);
+            }
+            if (k == 3)
+                continue;
+            auto index = master->find_entry_index(T_SIZE(holes[k] + diffs[k]));
+            assert(drop ? index == master->num_entries() : !master->get_entries()[index].is_valid());
+            char expected[6];
+            memset(expected, 'A' + k, 6);
+            if (handles[k])
+                assert(memcmp(master->deref(T_SIZE(handles[k] + bases[k])), expected, 6) == 0);
+            else
+                assert(bases[k] == 0);
+        }
+        master->compact();
+        assert(memcmp(master->deref(T_SIZE(handles[2] + bases[2])), "CCCCCC", 6) == 0);
+        EAT::destroy_master(master);
+    }
+
+    for (int k = 0; k < 4; ++k)
+    {
+        EAT::destroy_master(srcs[k]);
+    }
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test19(void)
+{
+    printf("## test19(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    void *base = master->malloc_(10);
+    assert(base != NULL);
+
+    auto fp = tmpfile();
+    assert(fp != NULL);
+    void *ptrs[20];
+    {
+        EAT::RECORDER<T_SIZE> rec(master, fp);
+        for (int i = 0; i < 20; ++i)
+        {
+            if (i % 5 == 1)
+                ptrs[i] = rec.aligned_malloc_(T_SIZE(i + 1), 16);
+            else if (i % 5 == 2)
+                ptrs[i] = rec.calloc_(T_SIZE(i), 3);
+            else
+                ptrs[i] = rec.malloc_(T_SIZE(i + 1));
+            assert(ptrs[i] != NULL);
+        }
+        assert(rec.malloc_(T_SIZE(t_total_size - 1)) == NULL); // too large
+        rec.free_(base);
+        for (int i = 0; i < 20; i += 3)
+        {
+            rec.free_(ptrs[i]);
+            ptrs[i] = NULL;
+        }
+        ptrs[4] = rec.realloc_(ptrs[4], 100);
+        ptrs[5] = rec.realloc_(ptrs[5], 2);
+        assert(ptrs[4] && ptrs[5]);
+        assert(rec.realloc_(ptrs[5], T_SIZE(t_total_size - 1)) == NULL); // too large
+
+        auto src = EAT::create_master<T_SIZE>(400);
+        void *p1 = src->malloc_(7);
+        void *p2 = src->aligned_malloc_(9, 8);
+        src->malloc_(11);
+        src->free_(p1);
+        memset(p2, 'x', 9);
+        T_SIZE diff;
+        assert(rec.merge(*src, &diff));
+        EAT::destroy_master(src);
+        src = EAT::create_master<T_SIZE>(t_total_size);
+        src->malloc_(T_SIZE(t_total_size - 100));
+        assert(!rec.merge(*src)); // no room
+        EAT::destroy_master(src);
+
+        ptrs[7] = rec.realloc_(ptrs[7], 0);
+        ptrs[8] = rec.realloc_(ptrs[8], 30);
+        ptrs[9] = rec.strdup_("ABC");
+        assert(ptrs[9] != NULL);
+        rec.compact();
+        auto index = master->prev_entry(master->num_entries());
+        rec.free_(master->ptr_from_offset(master->get_entries()[index].m_offset)); // moved
+        assert(rec.malloc_(5) != NULL);
+        assert(rec.is_ok());
+    }
+
+    // replay on the same configuration gives the same layout
+    for (int k = 0; k < 3; ++k)
+    {
+        rewind(fp);
+        EAT::TRACE_HEADER header;
+        assert(EAT::read_trace_header(fp, header));
+        assert(header.m_total_size == t_total_size);
+        assert(header.m_alignment == master->alignment());
+
+        static const T_SIZE s_totals[] = { t_total_size, 200, T_SIZE(4 * t_total_size) };
+        auto copy = EAT::create_master<T_SIZE>(s_totals[k]);
+        EAT::REPLAY_RESULT result;
+        assert(EAT::replay(copy, fp, result));
+        assert(copy->is_valid());
+        assert(result.m_calls[EAT::TRACE_BASE] == 1);
+        assert(result.m_calls[EAT::TRACE_COMPACT] == 1);
+        assert(result.m_calls[EAT::TRACE_MERGE] == 2);
+        assert(result.m_peak_used <= copy->total_size());
+        if (k == 2)
+        {
+            // the failed merge and realloc_ are not applied; the failed
+            // malloc_ is undone
+            assert(result.m_failures.empty() && result.m_recovered == 1);
+            assert(copy->num_entries() == master->num_entries());
+            assert(copy->data_area_size() == master->data_area_size());
+            EAT::destroy_master(copy);
+            continue;
+        }
+        assert(result.m_recovered == 0);
+        if (k)
+        {
+            assert(!result.m_failures.empty()); // too small
+            EAT::destroy_master(copy);
+            continue;
+        }
+
+        assert(result.m_failures.empty());
+        assert(copy->num_entries() == master->num_entries());
+        assert(copy->used_area_size() == master->used_area_size());
+        assert(memcmp(copy->get_entries(), master->get_entries(),
+                      master->num_entries() * master->entry_size()) == 0);
+        auto frag = EAT::fragmentation(*copy);
+        assert(frag.m_free_area == copy->free_area_size());
+        assert(frag.m_largest >= frag.m_free_area);
+        assert(frag.ratio() >= 0 && frag.ratio() < 1);
+        EAT::destroy_master(copy);
+    }
+
+    fclose(fp);
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE>
+void check_stats(const EAT::MASTER<T_SIZE> *master)
+{
+    uint64_t bytes = 0, count = 0;
+    master->count_live(bytes, count);
+    auto stats = master->get_stats();
+    assert(stats->m_live_bytes == bytes);
+    assert(stats->m_live_entries == count);
+    assert(stats->m_peak_used >= master->used_area_size());
+    assert(master->dead_bytes() == master->data_area_size() - bytes);
+    assert(master->dead_entries() == master->num_entries() - count);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test20(void)
+{
+    printf("## test20(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    void *first = master->malloc_(30);
+    if (!master->enable_stats())
+    {
+        printf("EAT_NO_STATS\n");
+        assert(master->dead_bytes() == 0 && master->live_entries() == 1);
+        EAT::destroy_master(master);
+        return;
+    }
+    assert(!master->should_compact());
+    auto stats = master->get_stats();
+    assert(stats->m_live_entries == 2); // with the stats block
+    check_stats(master);
+
+    void *ptrs[10];
+    for (int i = 0; i < 10; ++i)
+    {
+        ptrs[i] = master->aligned_malloc_(T_SIZE(10 + i), T_SIZE(i % 2 ? 8 : 1));
+        assert(ptrs[i] != NULL);
+    }
+    assert(master->malloc_(T_SIZE(t_total_size - 1)) == NULL);
+    stats = master->get_stats();
+    assert(stats->m_allocs == 10 && stats->m_failed == 1);
+    check_stats(master);
+
+    master->free_(first);
+    master->free_(ptrs[3]);
+    master->free_(ptrs[4]);
+    ptrs[2] = master->realloc_(ptrs[2], 20); // into the hole
+    ptrs[9] = master->realloc_(ptrs[9], 40); // the top block
+    ptrs[5] = master->realloc_(ptrs[5], 200); // moved
+    ptrs[5] = master->realloc_(ptrs[5], 100); // shrunk
+    assert(ptrs[2] && ptrs[5] && ptrs[9]);
+    stats = master->get_stats();
+    assert(stats->m_reallocs == 4);
+    assert(stats->m_frees == 4);
+    assert(master->fetch_entry(ptrs[0]) != NULL);
+    assert(stats->m_fetches > 0 && stats->m_probes >= stats->m_fetches);
+    check_stats(master);
+
+    T_SIZE sizes[3] = { 4, 0, 5 };
+    void *out[3];
+    assert(master->malloc_batch(sizes, 3, out));
+    check_stats(master);
+    void *victims[3] = { out[0], out[2], ptrs[6] };
+    master->free_batch(victims, 3);
+    check_stats(master);
+
+    auto mark = master->mark();
+    master->malloc_(7);
+    master->malloc_(8);
+    assert(master->release(mark));
+    check_stats(master);
+
+    // merge a source with its own stats
+    auto src = EAT::create_master<T_SIZE>(300);
+    void *p1 = src->malloc_(11);
+    assert(src->enable_stats());
+    src->malloc_(12);
+    src->free_(p1);
+    auto allocs = master->get_stats()->m_allocs, frees = master->get_stats()->m_frees;
+    assert(master->merge(*src));
+    check_stats(master);
+    EAT::destroy_master(src);
+    stats = master->get_stats();
+    assert(stats->m_allocs == allocs && stats->m_frees == frees);
+    assert(stats->m_system_frees == 1); // the copy of the source stats block
+
+    // compact by the policy
+    assert(master->dead_bytes() > 0);
+    assert(master->set_compact_policy(100));
+    assert(!master->auto_compact());
+    assert(master->set_compact_policy(1, 1));
+    auto h = master->alloc_handle(9);
+    memset(master->deref(h), 'h', 9);
+    stats = master->get_stats();
+    assert(stats->m_allocs == allocs + 1 && stats->m_system_allocs == 1); // and the handle table
+    assert(master->should_compact());
+    auto moved = master->get_stats()->m_moved;
+    assert(master->auto_compact());
+    stats = master->get_stats();
+    assert(stats->m_auto_compacts == 1 && stats->m_moved > moved);
+    assert(memcmp(master->deref(h), "hhhhhhhhh", 9) == 0);
+    check_stats(master);
+
+    // compact step by step
+    for (auto i = master->prev_entry(master->num_entries()); ; i = master->prev_entry(i))
+    {
+        void *ptr = master->ptr_from_offset(master->get_entries()[i].m_offset);
+        if (ptr != master->get_stats() && ptr != master->get_handle_table() && ptr != master->deref(h))
+        {
+            master->free_(ptr); // the lowest user block
+            break;
+        }
+    }
+    moved = master->get_stats()->m_moved;
+    while (!master->compact_step(8))
+        ;
+    assert(master->get_stats()->m_moved > moved);
+    assert(memcmp(master->deref(h), "hhhhhhhhh", 9) == 0);
+    check_stats(master);
+
+    // the stats are saved with the image
+    char path[] = "test20.bin";
+    assert(EAT::save_master(master, path, true));
+    auto loaded = EAT::load_master<T_SIZE>(path);
+    remove(path);
+    assert(loaded && loaded->has_stats());
+    assert(memcmp(loaded->get_stats(), master->get_stats(), sizeof(EAT::STATS)) == 0);
+    check_stats(loaded);
+    EAT::destroy_master(loaded);
+
+    master->reset_stats();
+    stats = master->get_stats();
+    assert(stats->m_allocs == 0 && stats->m_compact_percent == 1);
+    check_stats(master);
+    master->disable_stats();
+    assert(!master->has_stats() && master->is_valid());
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test21(void)
+{
+    printf("## test21(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    typedef EAT::allocator<int, T_SIZE> int_allocator;
+    typedef std::vector<int, int_allocator> vector_type;
+    struct ROOT
+    {
+        vector_type m_vector;
+        EAT::offset_ptr<int> m_ptr;
+        ROOT(master_type *master) : m_vector(int_allocator(master))
+        {
+        }
+    };
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    auto root = EAT::construct<ROOT>(master, master);
+    assert(root != NULL);
+    for (int i = 0; i < 100; ++i)
+    {
+        root->m_vector.push_back(i);
+    }
+    root->m_ptr = &root->m_vector[10];
+    auto root_offset = master->offset_from_ptr(root);
+
+    // map the image at another address
+    auto copy = EAT::create_master<T_SIZE>(master->total_size());
+    memcpy(static_cast<void *>(copy), static_cast<void *>(master), master->total_size());
+    memset(static_cast<void *>(master), 0xCD, master->total_size());
+    EAT::destroy_master(master);
+    for (int k = 0; k < 2; ++k)
+    {
+        root = reinterpret_cast<ROOT *>(copy->ptr_from_offset(root_offset));
+        assert(root->m_vector.get_allocator().master() == copy);
+        assert(root->m_vector.size() == size_t(100 + 10 * k));
+        for (size_t i = 0; i < root->m_vector.size(); ++i)
+        {
+            assert(root->m_vector[i] == int(i));
+        }
+        assert(*root->m_ptr == 10);
+        for (int i = 0; i < 10; ++i)
+        {
+            root->m_vector.push_back(int(root->m_vector.size()));
+        }
+        root->m_ptr = &root->m_vector[10];
+        assert(copy->is_valid());
+
+        // resize_master may move it
+        copy = EAT::resize_master(copy, copy->total_size() + 1000);
+        assert(copy != NULL);
+    }
+
+    // full
+    root = reinterpret_cast<ROOT *>(copy->ptr_from_offset(root_offset));
+    bool thrown = false;
+    try
+    {
+        for (;;)
+            root->m_vector.push_back(0);
+    }
+    catch (const std::bad_alloc&)
+    {
+        thrown = true;
+    }
+    assert(thrown && copy->is_valid());
+
+    EAT::destroy(copy, root);
+    assert(copy->empty());
+    EAT::destroy_master(copy);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test22(void)
+{
+    printf("## test22(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    assert(!master->find_named("none"));
+    void *junk[40];
+    char name[16];
+    for (int i = 0; i < 40; ++i)
+    {
+        sprintf(name, "obj%d", i);
+        junk[i] = master->malloc_(T_SIZE(3 + i % 5));
+        auto h = master->create_named(name, T_SIZE(4 + i % 3), uint32_t(i));
+        assert(h != 0);
+        memset(master->deref(h), 'a' + i % 26, 4 + i % 3);
+    }
+    assert(master->num_names() == 40);
+    assert(!master->create_named("obj7", 4)); // exists
+    assert(master->remove_named("obj7") && !master->remove_named("obj7"));
+    assert(master->remove_named("obj20"));
+    assert(master->set_named_flags("obj21", 0x100));
+
+    auto check = [](master_type *m, int i, bool present) {
+        char name[16], expected[8];
+        sprintf(name, "obj%d", i);
+        T_SIZE siz = 0;
+        uint32_t flags = 0;
+        auto h = m->find_named(name, &siz, &flags);
+        if (!present)
+        {
+            assert(h == 0);
+            return;
+        }
+        assert(h != 0 && siz == T_SIZE(4 + i % 3));
+        assert(flags == (i == 21 ? 0x100 : uint32_t(i)));
+        memset(expected, 'a' + i % 26, siz);
+        assert(memcmp(m->deref(h), expected, siz) == 0);
+    };
+
+    // compact moves the objects and the directory
+    for (int i = 0; i < 40; ++i)
+    {
+        master->free_(junk[i]);
+    }
+    master->compact();
+    for (int i = 0; i < 40; ++i)
+    {
+        check(master, i, i != 7 && i != 20);
+    }
+    int count = 0;
+    auto count_fn = [&count](const char *name, const typename master_type::NAME_SLOT&) {
+        assert(strncmp(name, "obj", 3) == 0);
+        ++count;
+        return true;
+    };
+    master->foreach_named(count_fn);
+    assert(count == 38);
+
+    // merge; the name of the destination wins
+    auto src = EAT::create_master<T_SIZE>(600);
+    auto h1 = src->create_named("obj1", 4);
+    memset(src->deref(h1), 'X', 4);
+    auto h2 = src->create_named("other", 5);
+    memcpy(src->deref(h2), "OTHER", 5);
+    master = EAT::grow_for_merge(master, &src, 1);
+    assert(master != NULL);
+    assert(master->merge_room(*src) <= master->free_area_size());
+    T_SIZE base;
+    assert(master->merge(*src, NULL, &base));
+    check(master, 1, true);
+    T_SIZE siz;
+    auto h = master->find_named("other", &siz);
+    assert(h == T_SIZE(h2 + base) && siz == 5);
+    assert(memcmp(master->deref(h), "OTHER", 5) == 0);
+    assert(master->num_names() == 39);
+
+    // a merge without room changes nothing, and a merge keeps the names
+    for (T_SIZE total = 200; total < 800; total = T_SIZE(total + 8))
+    {
+        auto dest = EAT::create_master<T_SIZE>(total);
+        auto h = dest->alloc_handle(4);
+        auto entries = dest->num_entries(), used = dest->used_area_size();
+        if (dest->merge(*src))
+        {
+            assert(dest->find_named("obj1") && dest->find_named("other"));
+        }
+        else
+        {
+            assert(dest->num_entries() == entries && dest->used_area_size() == used);
+            assert(dest->handle_capacity() == 8 && dest->deref(h));
+        }
+        assert(dest->is_valid());
+        EAT::destroy_master(dest);
+    }
+    EAT::destroy_master(src);
+
+    src = EAT::create_master<T_SIZE>(300);
+    memcpy(src->deref(src->create_named("many", 4)), "MANY", 4);
+    master = EAT::grow_for_merge(master, &src, 1);
+    assert(master && master->merge_many(&src, 1));
+    assert(memcmp(master->deref(master->find_named("many")), "MANY", 4) == 0);
+    EAT::destroy_master(src);
+
+    // lookup after loading, without a scan
+    char path[] = "test22.bin";
+    assert(EAT::save_master(master, path, true));
+    auto loaded = EAT::load_master<T_SIZE>(path);
+    remove(path);
+    assert(loaded != NULL);
+    for (int i = 0; i < 40; ++i)
+    {
+        check(loaded, i, i != 7 && i != 20);
+    }
+    assert(loaded->find_named("other") && loaded->find_named("many"));
+    EAT::destroy_master(loaded);
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test23(void)
+{
+    printf("## test23(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    typedef typename master_type::handle_type handle_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    assert(!master->slab_malloc_(8)); // not enabled
+    assert(!master->enable_slabs(1000) && !master->enable_slabs(128));
+    assert(master->enable_slabs(1024) && master->slab_size() == 1024);
+    assert(master->enable_slabs(1024) && !master->enable_slabs(2048));
+    assert(!master->slab_malloc_(0) && !master->slab_malloc_(129));
+    // the handle table stays
+    master->slab_free_(master->slab_malloc_(T_SIZE(1)));
+    auto base_entries = master->num_entries();
+
+    // many tiny objects on a few entries
+    const int count = 200;
+    void *ptrs[count];
+    handle_type slabs[count];
+    T_SIZE offsets[count];
+    void *junk[count / 10];
+    for (int i = 0; i < count; ++i)
+    {
+        if (i % 10 == 0)
+            junk[i / 10] = master->malloc_(T_SIZE(20));
+        ptrs[i] = master->slab_malloc_(T_SIZE(9 + i % 8));
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i & 0xFF, 9);
+        assert(uintptr_t(ptrs[i]) % 8 == 0);
+    }
+    assert(master->num_entries() < base_entries + count / 10 + 8);
+    // the slabs need the offsets aligned only
+    assert(master->max_alignment() == 1024 && master->image_alignment() < 1024);
+    for (int i = 0; i < count; ++i)
+    {
+        for (int k = 0; k < i; k += 17)
+            assert(ptrs[i] != ptrs[k]);
+    }
+
+    auto check = [](master_type *m, handle_type h, T_SIZE off, int i) {
+        auto p = static_cast<uint8_t *>(m->deref(h)) + off;
+        for (int k = 0; k < 9; ++k)
+            assert(p[k] == uint8_t(i & 0xFF));
+    };
+
+    // free some and compact; the objects move with their slabs
+    for (int i = 0; i < count; i += 3)
+    {
+        master->slab_free_(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    for (int i = 0; i < count / 10; ++i)
+    {
+        master->free_(junk[i]);
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        if (!ptrs[i])
+            continue;
+        slabs[i] = master->slab_of(ptrs[i]);
+        offsets[i] = T_SIZE(static_cast<char *>(ptrs[i]) - static_cast<char *>(master->deref(slabs[i])));
+    }
+    master->compact();
+    assert(master->is_valid());
+    for (int i = 0; i < count; ++i)
+    {
+        if (!ptrs[i])
+            continue;
+        check(master, slabs[i], offsets[i], i);
+        ptrs[i] = static_cast<char *>(master->deref(slabs[i])) + offsets[i];
+        assert(master->slab_of(ptrs[i]) == slabs[i]);
+    }
+
+    // the freed objects are reused
+    auto entries = master->num_entries();
+    for (int i = 0; i < count; i += 3)
+    {
+        ptrs[i] = master->slab_malloc_(T_SIZE(9));
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i & 0xFF, 9);
+    }
+    assert(master->num_entries() == entries);
+
+    // the empty slabs are freed
+    for (int i = 0; i < count; ++i)
+    {
+        master->slab_free_(ptrs[i]);
+    }
+    assert(master->num_entries() == base_entries);
+    assert(master->is_valid());
+
+    // merge the slabs of the source
+    auto src = EAT::create_master<T_SIZE>(4000);
+    assert(src->enable_slabs(1024));
+    T_SIZE src_offsets[30];
+    for (int i = 0; i < 30; ++i)
+    {
+        auto q = src->slab_malloc_(T_SIZE(40));
+        assert(q != NULL);
+        memset(q, i, 40);
+        src_offsets[i] = T_SIZE(static_cast<char *>(q) - reinterpret_cast<char *>(src));
+    }
+    master = EAT::grow_for_merge(master, &src, 1);
+    assert(master != NULL);
+    T_SIZE diff;
+    assert(master->merge(*src, &diff, NULL));
+    EAT::destroy_master(src);
+    void *mine = master->slab_malloc_(T_SIZE(48)); // from the merged slab
+    assert(mine != NULL);
+    for (int i = 0; i < 30; ++i)
+    {
+        auto q = reinterpret_cast<uint8_t *>(master) + src_offsets[i] + diff;
+        assert(q[0] == i && q[39] == i);
+        master->slab_free_(q);
+    }
+    master->slab_free_(mine);
+    assert(master->is_valid());
+
+    // a merge without room for the slab directory changes nothing
+    src = EAT::create_master<T_SIZE>(3000);
+    assert(src->enable_slabs(1024));
+    auto obj = src->slab_malloc_(T_SIZE(8));
+    auto obj_offset = T_SIZE(static_cast<char *>(obj) - reinterpret_cast<char *>(src));
+    for (T_SIZE total = 1500; total < 3500; total = T_SIZE(total + 16))
+    {
+        auto dest = EAT::create_master<T_SIZE>(total);
+        auto used = dest->used_area_size();
+        if (dest->merge(*src, &diff))
+        {
+            assert(dest->slab_size() == 1024);
+            dest->slab_free_(reinterpret_cast<char *>(dest) + obj_offset + diff);
+        }
+        else
+        {
+            assert(!dest->has_slabs() && dest->used_area_size() == used);
+        }
+        assert(dest->is_valid());
+        EAT::destroy_master(dest);
+    }
+    EAT::destroy_master(src);
+
+    // the slab sizes must agree
+    src = EAT::create_master<T_SIZE>(6000);
+    assert(src->enable_slabs(2048));
+    assert(src->slab_malloc_(T_SIZE(8)) != NULL);
+    master = EAT::grow_for_merge(master, &src, 1);
+    assert(master != NULL);
+    assert(!master->merge(*src));
+    assert(!master->merge_many(&src, 1));
+    EAT::destroy_master(src);
+
+    // a destination without slabs takes the slab size of the source
+    auto dest = EAT::create_master<T_SIZE>(t_total_size);
+    src = EAT::create_master<T_SIZE>(4000);
+    assert(src->enable_slabs(1024));
+    auto p = src->slab_malloc_(T_SIZE(100));
+    memcpy(p, "SLAB", 5);
+    auto offset = T_SIZE(static_cast<char *>(p) - reinterpret_cast<char *>(src));
+    assert(dest->merge_many(&src, 1, &diff));
+    EAT::destroy_master(src);
+    assert(dest->slab_size() == 1024);
+    p = reinterpret_cast<char *>(dest) + offset + diff;
+    assert(memcmp(p, "SLAB", 5) == 0);
+    dest->slab_free_(p);
+    assert(dest->is_valid());
+    EAT::destroy_master(dest);
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test24(void)
+{
+    printf("## test24(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef EAT::MASTER<T_SIZE> master_type;
+    auto master = EAT::create_master<T_SIZE>(t_total_size);
+    assert(!master->find_interned("red"));
+    static const char *const s_words[] = { "red", "green", "blue", "", "red" };
+    const char *copies[5];
+    for (int k = 0; k < 10; ++k)
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            auto str = master->intern_(s_words[i]);
+            assert(str != NULL && strcmp(str, s_words[i]) == 0);
+            if (k == 0)
+                copies[i] = str;
+            assert(str == copies[i]);
+        }
+    }
+    assert(copies[0] == copies[4] && copies[0] != copies[1]);
+    assert(master->num_names() == 4);
+
+    // apart from the named objects
+    auto h = master->create_named("red", 4);
+    assert(h != 0 && master->deref(h) != copies[0]);
+    assert(master->find_named("green") == 0);
+    assert(master->intern_("red") == copies[0]);
+    int count = 0;
+    auto count_fn = [&count](const char *name, const typename master_type::NAME_SLOT&) {
+        assert(strcmp(name, "red") == 0);
+        ++count;
+        return true;
+    };
+    master->foreach_named(count_fn);
+    assert(count == 1);
+
+    // compact moves them
+    void *junk = master->malloc_(T_SIZE(30));
+    master->intern_("after");
+    master->free_(junk);
+    master->compact();
+    auto after = master->find_interned("after");
+    assert(after && strcmp(after, "after") == 0 && master->intern_("after") == after);
+
+    // merge unifies the strings of both
+    auto src = EAT::create_master<T_SIZE>(600);
+    auto src_red = src->intern_("red");
+    auto src_red_offset = T_SIZE(src_red - reinterpret_cast<const char *>(src));
+    auto src_cyan_offset = T_SIZE(src->intern_("cyan") - reinterpret_cast<const char *>(src));
+    master = EAT::grow_for_merge(master, &src, 1);
+    assert(master != NULL);
+    auto red = master->intern_("red");
+    T_SIZE diff;
+    assert(master->merge(*src, &diff));
+    EAT::destroy_master(src);
+    auto base = reinterpret_cast<const char *>(master);
+    assert(master->intern_("red") == red); // the destination copy
+    assert(strcmp(base + src_red_offset + diff, "red") == 0); // kept
+    assert(master->intern_("cyan") == base + src_cyan_offset + diff);
+    assert(master->num_names() == 7);
+
+    // persists
+    char path[] = "test24.bin";
+    assert(EAT::save_master(master, path, true));
+    auto loaded = EAT::load_master<T_SIZE>(path);
+    remove(path);
+    assert(loaded != NULL);
+    auto loaded_green = loaded->find_interned("green");
+    assert(loaded_green && strcmp(loaded_green, "green") == 0);
+    assert(loaded->intern_("green") == loaded_green);
+    assert(loaded->num_names() == 7);
+    EAT::destroy_master(loaded);
+
+    EAT::destroy_master(master);
+}
+
+template <typename T_SIZE, T_SIZE t_total_size>
+void test25(void)
+{
+    printf("## test25(%d,%d)\n", int(sizeof(T_SIZE)), int(t_total_size));
+
+    typedef typename std::conditional<sizeof(T_SIZE) == 2, uint32_t, uint64_t>::type wide_type;
+    assert(!EAT::create_master<uint16_t>(0x10000)); // too large
+
+    auto master = EAT::create_master<T_SIZE>(t_total_size, 64);
+    assert(master->track_dirty(256));
+    master->enable_stats();
+    void *plain[10];
+    T_SIZE offsets[10];
+    T_SIZE handles[10];
+    for (int i = 0; i < 10; ++i)
+    {
+        plain[i] = master->aligned_malloc_(T_SIZE(5 + i), T_SIZE(i == 3 ? 64 : 8));
+        memset(plain[i], 'a' + i, 5 + i);
+        offsets[i] = T_SIZE(static_cast<char *>(plain[i]) - reinterpret_cast<char *>(master));
+        handles[i] = master->alloc_handle(T_SIZE(7 + i));
+        memset(master->deref(handles[i]), 'A' + i, 7 + i);
+    }
+    auto named = master->create_named("named", 3);
+    memcpy(master->deref(named), "NMD", 3);
+    master->intern_("interned");
+    master->free_(plain[5]);
+    master->free_handle(handles[6]);
+
+    auto check = [&](EAT::MASTER<wide_type> *m, wide_type diff, bool compacted) {
+        assert(m->is_valid());
+        char expected[32];
+        for (int i = 0; i < 10; ++i)
+        {
+            if (i != 5 && !compacted)
+            {
+                memset(expected, 'a' + i, 5 + i);
+                assert(memcmp(reinterpret_cast<char *>(m) + offsets[i] + diff, expected, 5 + i) == 0);
+            }
+            if (i != 6)
+            {
+                memset(expected, 'A' + i, 7 + i);
+                assert(m->handle_size(handles[i]) == wide_type(7 + i));
+                assert(memcmp(m->deref(handles[i]), expected, 7 + i) == 0);
+            }
+        }
+        assert(m->deref(handles[6]) == NULL);
+        wide_type siz = 0;
+        assert(m->find_named("named", &siz) == named && siz == 3);
+        assert(memcmp(m->deref(named), "NMD", 3) == 0);
+        assert(m->find_interned("interned") && !m->find_named("interned"));
+    };
+
+    // slabs cannot be widened, and the master is kept
+    auto slabbed = EAT::create_master<T_SIZE>(4000);
+    assert(slabbed->enable_slabs(1024));
+    assert(!EAT::widen_master<wide_type>(slabbed));
+    assert(slabbed->is_valid());
+    EAT::destroy_master(slabbed);
+
+    // the free area is kept
+    auto free_size = master->free_area_size();
+    wide_type diff;
+    auto wide = EAT::widen_master<wide_type>(master, 0, &diff);
+    assert(wide != NULL);
+    assert(wide->size_type_size() == sizeof(wide_type) && wide->free_area_size() >= free_size);
+    assert((offsets[3] + diff) % 64 == 0);
+    check(wide, diff, false);
+    assert(wide->is_tracking() && wide->is_dirty_page(0));
+    if (wide->has_stats())
+        assert(wide->live_entries() >= 20);
+
+    // it works as usual
+    auto h = wide->alloc_handle(wide_type(40));
+    assert(h != 0);
+    auto p = wide->malloc_(wide_type(30));
+    assert(p != NULL);
+    wide->free_(p);
+    wide->free_handle(h);
+    wide->compact(); // moves the plain blocks
+    check(wide, diff, true);
+    EAT::destroy_master(wide);
+
+    // promote on demand
+    EAT::AUTO_MASTER automatic(256);
+    assert(automatic.size_type_size() == 2);
+    const int count = 2000;
+    std::vector<uint64_t> hs;
+    for (int i = 0; i < count; ++i)
+    {
+        auto h = automatic.alloc_handle(100);
+        assert(h != 0);
+        memset(automatic.deref(h), i & 0xFF, 100);
+        hs.push_back(h);
+    }
+    assert(automatic.size_type_size() == 4 && automatic.total_size() > 200000);
+    void *big = automatic.malloc_(70000);
+    assert(big != NULL);
+    automatic.free_(big);
+    for (int i = 0; i < count; ++i)
+    {
+        auto q = static_cast<uint8_t *>(automatic.deref(hs[i]));
+        assert(q[0] == uint8_t(i & 0xFF) && q[99] == uint8_t(i & 0xFF));
+        if (i % 2)
+            automatic.free_handle(hs[i]);
+    }
+    assert(automatic.master32()->is_valid());
+
+    // within the limit
+    EAT::AUTO_MASTER limited(256, 60000);
+    int n = 0;
+    while (limited.malloc_(1000))
+        ++n;
+    assert(limited.size_type_size() == 2 && n > 50 && limited.total_size() <= 60000);
+}
+
 int main(void)
 {
     assert(sizeof(int8_t) == 1);
@@ -56,6 +2330,55 @@ int main(void)
     test1<uint32_t, 300>();
     test1<uint16_t, 400>();
     test1<uint32_t, 400>();
+    test2<uint16_t, 2000>();
+    test2<uint32_t, 2000>();
+    test3<uint16_t, 1000>();
+    test3<uint32_t, 1000>();
+    test4<uint16_t, 1000>();
+    test4<uint32_t, 1000>();
+    test5<uint16_t, 1000>();
+    test5<uint32_t, 1000>();
+    test6<uint16_t, 2000>();
+    test6<uint32_t, 2000>();
+    test7<uint16_t, 300>();
+    test7<uint32_t, 300>();
+    test8<uint16_t, 2000>();
+    test8<uint32_t, 2000>();
+    test9<uint16_t, 1000>();
+    test9<uint32_t, 1000>();
+    test10<uint16_t, 1000>();
+    test10<uint32_t, 1000>();
+    test11<uint16_t, 1000>();
+    test11<uint32_t, 1000>();
+    test12<uint16_t, 4000>();
+    test12<uint32_t, 4000>();
+    test13<uint16_t, 1000>();
+    test13<uint32_t, 1000>();
+    test14<uint16_t, 1000>();
+    test14<uint32_t, 1000>();
+    test15<uint16_t, 2000>();
+    test15<uint32_t, 2000>();
+    test15<uint64_t, 4000>();
+    test16<uint16_t, 1000>();
+    test16<uint32_t, 1000>();
+    test17<uint16_t, 4000>();
+    test17<uint32_t, 4000>();
+    test18<uint16_t, 200>();
+    test18<uint32_t, 200>();
+    test19<uint16_t, 1000>();
+    test19<uint32_t, 1000>();
+    test20<uint16_t, 2000>();
+    test20<uint32_t, 2000>();
+    test21<uint16_t, 2000>();
+    test21<uint32_t, 2000>();
+    test22<uint16_t, 8000>();
+    test22<uint32_t, 8000>();
+    test23<uint16_t, 20000>();
+    test23<uint32_t, 20000>();
+    test24<uint16_t, 2000>();
+    test24<uint32_t, 2000>();
+    test25<uint16_t, 2000>();
+    test25<uint32_t, 2000>();
 
     return 0;
 }
@@ -0,0 +1,424 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+// The multi-threaded front ends. Each thread allocates from its own
+// sub-master without locking, and publishes the blocks to the shared master
+// in bulk. Or the threads bump-allocate from one master without locking.
+
+#ifndef EYEBALL_ALLOCATION_TABLE_THREAD
+#define EYEBALL_ALLOCATION_TABLE_THREAD
+
+#include "eat.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+
+namespace EAT
+{
+    template <typename T_SIZE>
+    struct LOCAL;
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::SHARED<T_SIZE> --- the shared master and its sub-masters
+    //
+    // NOTE: The shared master is guarded by mutex(). Lock it to use master()
+    //       directly. Publishing may grow the shared master up to the limit,
+    //       so the master may move; keep offsets or handles, not pointers.
+    //       master() is NULL if the shared master cannot be created; then
+    //       publish fails.
+
+    template <typename T_SIZE>
+    struct SHARED
+    {
+        // Types
+        typedef T_SIZE            size_type;
+        typedef MASTER<T_SIZE>    master_type;
+        typedef LOCAL<T_SIZE>     local_type;
+
+        SHARED(size_t total_size, size_t limit = size_t(T_SIZE(-1)))
+            : m_master(create_master<T_SIZE>(total_size)), m_limit(limit)
+        {
+        }
+        ~SHARED()
+        {
+            assert(m_locals.empty());
+            destroy_master(m_master);
+        }
+
+        master_type *master()
+        {
+            return m_master;
+        }
+        std::mutex& mutex()
+        {
+            return m_mutex;
+        }
+
+        // the sub-master that owns ptr, or NULL
+        local_type *owner_of(const void *ptr)
+        {
+            std::lock_guard<std::mutex> lock(m_locals_mutex);
+            for (auto local : m_locals)
+            {
+                if (local->owns(ptr))
+                    return local;
+            }
+            return NULL;
+        }
+
+        // free a block of the shared master or of any sub-master.
+        // a block of a sub-master is queued and freed by its owner thread.
+        void free_(void *ptr)
+        {
+            if (!ptr)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(m_locals_mutex);
+                for (auto local : m_locals)
+                {
+                    if (local->owns(ptr))
+                    {
+                        local->free_remote(ptr);
+                        return;
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(m_master);
+            if (m_master)
+                m_master->free_(ptr);
+        }
+
+    protected:
+        master_type *m_master;
+        size_t m_limit;
+        std::mutex m_mutex;                 // guards m_master
+        std::mutex m_locals_mutex;          // guards m_locals
+        std::vector<local_type *> m_locals;
+
+        friend struct LOCAL<T_SIZE>;
+
+        // not copyable
+        SHARED(const SHARED&);
+        SHARED& operator=(const SHARED&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::LOCAL<T_SIZE> --- the sub-master of a thread
+    //
+    // NOTE: Only the owner thread may call the members except free_remote.
+    //       publish merges the blocks into the shared master and empties the
+    //       sub-master, so the pointers into it are no longer valid. A local
+    //       offset o is o + diff and a local handle h is h + handle_base in
+    //       the shared master.
+    //       A block freed by another thread is queued and freed at the next
+    //       malloc_, free_ or publish of the owner.
+    //       master() is NULL if the sub-master cannot be created; then the
+    //       allocations return NULL and publish fails.
+
+    template <typename T_SIZE>
+    struct LOCAL
+    {
+        // Types
+        typedef T_SIZE            size_type;
+        typedef MASTER<T_SIZE>    master_type;
+        typedef SHARED<T_SIZE>    shared_type;
+
+        LOCAL(shared_type& shared, size_t total_size)
+            : m_shared(shared), m_master(create_master<T_SIZE>(total_size)), m_queued(false)
+        {
+            std::lock_guard<std::mutex> lock(shared.m_locals_mutex);
+            shared.m_locals.push_back(this);
+        }
+        ~LOCAL()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_shared.m_locals_mutex);
+                auto& locals = m_shared.m_locals;
+                locals.erase(std::remove(locals.begin(), locals.end(), this), locals.end());
+            }
+            destroy_master(m_master);
+        }
+
+        master_type *master()
+        {
+            return m_master;
+        }
+        bool owns(const void *ptr) const
+        {
+            auto base = reinterpret_cast<const char *>(m_master);
+            auto p = reinterpret_cast<const char *>(ptr);
+            return m_master && base + m_master->head_size() <= p && p < base + m_master->total_size();
+        }
+
+        void *malloc_(size_type siz)
+        {
+            if (!m_master)
+                return NULL; // no sub-master
+            drain();
+            return m_master->malloc_(siz);
+        }
+        void *aligned_malloc_(size_type siz, size_type align)
+        {
+            if (!m_master)
+                return NULL; // no sub-master
+            drain();
+            return m_master->aligned_malloc_(siz, align);
+        }
+        void *realloc_(void *ptr, size_type siz)
+        {
+            assert(!ptr || owns(ptr));
+            if (!m_master)
+                return NULL; // no sub-master
+            drain();
+            return m_master->realloc_(ptr, siz);
+        }
+
+        // free a block of any master
+        void free_(void *ptr)
+        {
+            if (!ptr)
+                return;
+            if (!owns(ptr))
+            {
+                m_shared.free_(ptr);
+                return;
+            }
+            drain();
+            m_master->free_(ptr);
+        }
+
+        // queue a block freed by another thread
+        void free_remote(void *ptr)
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_queue.push_back(ptr);
+            m_queued.store(true, std::memory_order_release);
+        }
+
+        // free the queued blocks
+        void drain()
+        {
+            if (!m_master || !m_queued.load(std::memory_order_acquire))
+                return;
+            std::vector<void *> queue;
+            {
+                std::lock_guard<std::mutex> lock(m_queue_mutex);
+                queue.swap(m_queue);
+                m_queued.store(false, std::memory_order_relaxed);
+            }
+            for (auto ptr : queue)
+            {
+                m_master->free_(ptr);
+            }
+        }
+
+        // merge the blocks into the shared master, growing it if necessary
+        bool publish(size_type *pdiff = NULL, size_type *phandle_base = NULL)
+        {
+            if (!m_master)
+                return false; // no sub-master
+            drain();
+            if (m_master->empty())
+            {
+                if (pdiff)
+                    *pdiff = 0;
+                if (phandle_base)
+                    *phandle_base = 0;
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(m_shared.m_mutex);
+            auto shared = m_shared.m_master;
+            if (!shared)
+                return false; // no shared master
+            auto room = shared->merge_room(*m_master);
+            auto align = m_master->address_alignment();
+            if (room > shared->free_area_size() || !detail::is_aligned_ptr(shared, align))
+            {
+                auto new_total_size = grown_size(shared, room, m_shared.m_limit);
+                if (!new_total_size)
+                    return false; // out of memory
+                auto new_shared = resize_master(shared, new_total_size, align);
+                if (!new_shared)
+                    return false; // out of memory
+                m_shared.m_master = shared = new_shared;
+            }
+
+            if (!shared->merge(*m_master, pdiff, phandle_base))
+                return false;
+            m_master->clear(false);
+            return true;
+        }
+
+    protected:
+        shared_type& m_shared;
+        master_type *m_master;
+        std::mutex m_queue_mutex;           // guards m_queue
+        std::vector<void *> m_queue;        // the blocks freed by the others
+        std::atomic<bool> m_queued;
+
+        // not copyable
+        LOCAL(const LOCAL&);
+        LOCAL& operator=(const LOCAL&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::CONCURRENT<T_SIZE> --- lock-free bump allocation on a master
+    //
+    // NOTE: The two boundaries are packed into one atomic word, so that one
+    //       CAS reserves both the data and the entry. Holes are not reused.
+    //       While it is attached, only malloc_ may touch the master. Other
+    //       operations need the threads to stop and detach() first.
+    //       T_SIZE must be 32-bit or less to fit a lock-free atomic word.
+
+    template <typename T_SIZE>
+    struct CONCURRENT
+    {
+        // Types
+        typedef T_SIZE            size_type;
+        typedef MASTER<T_SIZE>    master_type;
+        typedef ENTRY<T_SIZE>     entry_type;
+        typedef typename std::conditional<sizeof(T_SIZE) <= 2, uint32_t, uint64_t>::type
+                                  bounds_type;
+
+        static_assert(sizeof(T_SIZE) <= 4, "T_SIZE is too large");
+
+        CONCURRENT(master_type *master) : m_master(master), m_attached(true)
+        {
+            m_bounds.store(pack(master->m_boudary_1, master->m_boudary_2));
+        }
+        ~CONCURRENT()
+        {
+            detach();
+        }
+
+        master_type *master()
+        {
+            return m_master;
+        }
+
+        void *malloc_(size_type siz)
+        {
+            return aligned_malloc_(siz, m_master->alignment());
+        }
+        void *aligned_malloc_(size_type siz, size_type align)
+        {
+            assert(m_attached);
+            if (siz <= 0 || !master_type::is_valid_alignment(align) ||
+                !detail::is_aligned_ptr(m_master, align))
+            {
+                return NULL;
+            }
+
+            auto entry_size = m_master->entry_size();
+            auto bounds = m_bounds.load(std::memory_order_relaxed);
+            size_type offset, b2;
+            for (;;)
+            {
+                auto b1 = boundary_1(bounds);
+                b2 = boundary_2(bounds);
+                offset = master_type::align_up(b1, align);
+                auto required = size_type(siz + entry_size);
+                if (offset < b1 || required < siz || offset > b2 || required > b2 - offset)
+                    return NULL; // no room
+                b2 -= entry_size;
+                if (m_bounds.compare_exchange_weak(bounds, pack(size_type(offset + siz), b2),
+                                                   std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+
+            // the reserved entry belongs to this thread
+            auto entry = reinterpret_cast<entry_type *>(m_master->ptr_from_offset(b2));
+            *entry = entry_type(siz, offset, master_type::entry_flags(align));
+            return m_master->ptr_from_offset(offset);
+        }
+
+        // write the boundaries back to the master, once.
+        // no malloc_ may be running.
+        void detach()
+        {
+            if (!m_attached)
+                return;
+            m_attached = false;
+            auto bounds = m_bounds.load(std::memory_order_acquire);
+            if (boundary_1(bounds) != m_master->m_boudary_1)
+                m_master->allocated_at(m_master->m_boudary_1);
+            m_master->dirty_range(m_master->m_boudary_1, boundary_1(bounds) - m_master->m_boudary_1);
+            m_master->dirty_table(m_master->m_boudary_2);
+            m_master->m_boudary_1 = boundary_1(bounds);
+            m_master->m_boudary_2 = boundary_2(bounds);
+            m_master->recount_stats();
+            assert(m_master->is_valid());
+        }
+
+    protected:
+        master_type *m_master;
+        std::atomic<bounds_type> m_bounds;  // boundary_2 in the upper half
+        bool m_attached;
+
+        static bounds_type pack(size_type b1, size_type b2)
+        {
+            return bounds_type(b1) | (bounds_type(b2) << (8 * sizeof(size_type)));
+        }
+        static size_type boundary_1(bounds_type bounds)
+        {
+            return size_type(bounds);
+        }
+        static size_type boundary_2(bounds_type bounds)
+        {
+            return size_type(bounds >> (8 * sizeof(size_type)));
+        }
+
+        // not copyable
+        CONCURRENT(const CONCURRENT&);
+        CONCURRENT& operator=(const CONCURRENT&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::PARALLEL_RUNNER --- runs the jobs on the threads
+    //
+    // NOTE: Pass it to MASTER::merge_many to copy the sources on the threads,
+    //       one source at a time on each thread. The calling thread works too.
+
+    struct PARALLEL_RUNNER
+    {
+        PARALLEL_RUNNER(unsigned num_threads = std::thread::hardware_concurrency())
+            : m_num_threads(num_threads ? num_threads : 1)
+        {
+        }
+
+        template <typename T_JOB>
+        void operator()(size_t count, T_JOB& job) const
+        {
+            std::atomic<size_t> next(0);
+            auto worker = [&next, &job, count]() {
+                for (size_t k; (k = next.fetch_add(1, std::memory_order_relaxed)) < count; )
+                {
+                    job(k);
+                }
+            };
+            std::vector<std::thread> threads;
+            for (size_t t = 1; t < m_num_threads && t < count; ++t)
+            {
+                threads.push_back(std::thread(worker));
+            }
+            worker();
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+    protected:
+        unsigned m_num_threads;
+    };
+} // namespace EAT
+
+#endif  // ndef EYEBALL_ALLOCATION_TABLE_THREAD
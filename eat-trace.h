@@ -0,0 +1,548 @@
+// E.A.T. --- Eyeball Allocation Table (EAT), written by katahiromz.
+// It's a specialized memory management system in C++. See file License.txt.
+//////////////////////////////////////////////////////////////////////////////
+// The allocation traces. A recorder logs the calls on a master to a compact
+// binary trace, and replay re-runs a trace on a master of any size type and
+// size, to reproduce the fragmentation and the failures of a workload.
+
+#ifndef EYEBALL_ALLOCATION_TABLE_TRACE
+#define EYEBALL_ALLOCATION_TABLE_TRACE
+
+#include "eat.h"
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+
+namespace EAT
+{
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::TRACE_OP --- the records of a trace
+    //
+    // NOTE: A trace is "EATT", the version byte, the total size and the
+    //       default alignment of the recorded master, and the records. A
+    //       record is an opcode byte and its operands in LEB128:
+    //           TRACE_BASE     count, (size, flags) * count
+    //           TRACE_MALLOC   size, log2 of the alignment
+    //           TRACE_CALLOC   nelem, size
+    //           TRACE_REALLOC  id, size
+    //           TRACE_FREE     id
+    //           TRACE_COMPACT
+    //           TRACE_MERGE    count, (size, flags) * count
+    //       A block is named by its id, the number of the blocks allocated
+    //       before it, so that a trace does not depend on the size type or
+    //       the addresses. The layouts of TRACE_BASE (the blocks of the
+    //       master at the start) and TRACE_MERGE (the source) list the
+    //       entries from the bottom with the flags of the entry; the valid
+    //       ones get the ids. TRACE_FAILED is set if the call failed.
+
+    enum TRACE_OP
+    {
+        TRACE_BASE,
+        TRACE_MALLOC,
+        TRACE_CALLOC,
+        TRACE_REALLOC,
+        TRACE_FREE,
+        TRACE_COMPACT,
+        TRACE_MERGE,
+        TRACE_NUM_OPS,
+        TRACE_FAILED = 0x80
+    };
+
+    namespace detail
+    {
+        const char TRACE_MAGIC[4] = { 'E', 'A', 'T', 'T' };
+        const int TRACE_VERSION = 1;
+
+        inline void put_varint(FILE *fp, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                std::fputc(int(value & 0x7F) | 0x80, fp);
+                value >>= 7;
+            }
+            std::fputc(int(value), fp);
+        }
+        inline bool get_varint(FILE *fp, uint64_t& value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                int ch = std::fgetc(fp);
+                if (ch == EOF)
+                    return false;
+                value |= uint64_t(ch & 0x7F) << shift;
+                if (!(ch & 0x80))
+                    return true;
+            }
+            return false; // too long
+        }
+
+        inline int log2_of(uint64_t value)
+        {
+            int shift = 0;
+            while ((uint64_t(1) << shift) < value)
+                ++shift;
+            return shift;
+        }
+
+        // the offsets of the valid blocks in ascending order. compact keeps
+        // the order, so the k-th offset before it becomes the k-th after it.
+        template <typename T_SIZE>
+        inline void valid_offsets(const MASTER<T_SIZE>& master, std::vector<T_SIZE>& offsets)
+        {
+            offsets.clear();
+            auto entries = master.get_entries();
+            auto num = master.num_entries();
+            for (auto i = master.prev_entry(num); i < num; i = master.prev_entry(i))
+            {
+                offsets.push_back(T_SIZE(entries[i].m_offset));
+            }
+        }
+        template <typename T_SIZE>
+        inline T_SIZE compacted_offset(const std::vector<T_SIZE>& old_offsets,
+                                       const std::vector<T_SIZE>& new_offsets, T_SIZE offset)
+        {
+            auto it = std::lower_bound(old_offsets.begin(), old_offsets.end(), offset);
+            assert(it != old_offsets.end() && *it == offset);
+            return new_offsets[it - old_offsets.begin()];
+        }
+    } // namespace detail
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::RECORDER<T_SIZE> --- records the calls on a master
+    //
+    // NOTE: Call the master through the recorder to record the calls. A
+    //       block allocated around the recorder is not known to the trace.
+    //       If the master moves (by resize_master), call set_master.
+
+    template <typename T_SIZE>
+    struct RECORDER
+    {
+        // Types
+        typedef T_SIZE                      size_type;
+        typedef MASTER<T_SIZE>              master_type;
+        typedef ENTRY<T_SIZE>               entry_type;
+
+        RECORDER(master_type *master, FILE *fp) : m_master(master), m_fp(fp), m_next_id(0)
+        {
+            std::fwrite(detail::TRACE_MAGIC, 1, sizeof(detail::TRACE_MAGIC), fp);
+            std::fputc(detail::TRACE_VERSION, fp);
+            detail::put_varint(fp, master->total_size());
+            detail::put_varint(fp, master->alignment());
+            put_layout(TRACE_BASE, *master, 0);
+        }
+
+        master_type *master()
+        {
+            return m_master;
+        }
+        void set_master(master_type *master)
+        {
+            m_master = master;
+        }
+        bool is_ok() const
+        {
+            return !std::ferror(m_fp);
+        }
+
+        void *malloc_(size_type siz)
+        {
+            return aligned_malloc_(siz, m_master->alignment());
+        }
+        void *aligned_malloc_(size_type siz, size_type align)
+        {
+            void *ptr = m_master->aligned_malloc_(siz, align);
+            put_op(TRACE_MALLOC, ptr != NULL);
+            detail::put_varint(m_fp, siz);
+            detail::put_varint(m_fp, uint64_t(detail::log2_of(align)));
+            add_block(ptr);
+            return ptr;
+        }
+        void *calloc_(size_type nelem, size_type siz)
+        {
+            void *ptr = m_master->calloc_(nelem, siz);
+            put_op(TRACE_CALLOC, ptr != NULL);
+            detail::put_varint(m_fp, nelem);
+            detail::put_varint(m_fp, siz);
+            add_block(ptr);
+            return ptr;
+        }
+        void *realloc_(void *ptr, size_type siz)
+        {
+            if (!ptr)
+                return malloc_(siz);
+            if (siz <= 0)
+            {
+                free_(ptr);
+                return NULL;
+            }
+
+            auto it = m_ids.find(m_master->offset_from_ptr(ptr));
+            void *new_ptr = m_master->realloc_(ptr, siz);
+            if (it == m_ids.end())
+                return new_ptr; // not known
+            auto id = it->second;
+            put_op(TRACE_REALLOC, new_ptr != NULL);
+            detail::put_varint(m_fp, id);
+            detail::put_varint(m_fp, siz);
+            if (new_ptr && new_ptr != ptr)
+            {
+                m_ids.erase(it);
+                m_ids[m_master->offset_from_ptr(new_ptr)] = id;
+            }
+            return new_ptr;
+        }
+        void free_(void *ptr)
+        {
+            if (!ptr)
+                return;
+            auto it = m_ids.find(m_master->offset_from_ptr(ptr));
+            m_master->free_(ptr);
+            if (it == m_ids.end())
+                return; // not known
+            put_op(TRACE_FREE, true);
+            detail::put_varint(m_fp, it->second);
+            m_ids.erase(it);
+        }
+        char *strdup_(const char *psz)
+        {
+            auto siz = size_type(std::strlen(psz) + 1);
+            auto ret = reinterpret_cast<char *>(malloc_(siz));
+            if (ret)
+                std::memcpy(ret, psz, siz);
+            return ret;
+        }
+
+        void compact()
+        {
+            std::vector<size_type> old_offsets, new_offsets;
+            detail::valid_offsets(*m_master, old_offsets);
+            m_master->compact();
+            detail::valid_offsets(*m_master, new_offsets);
+            put_op(TRACE_COMPACT, true);
+
+            std::unordered_map<size_type, uint64_t> ids;
+            for (auto& pair : m_ids)
+            {
+                ids[detail::compacted_offset(old_offsets, new_offsets, pair.first)] = pair.second;
+            }
+            m_ids.swap(ids);
+        }
+
+        bool merge(const master_type& src, size_type *pdiff = NULL, size_type *phandle_base = NULL)
+        {
+            size_type diff = 0;
+            bool ok = (m_master->merge_room(src) <= m_master->free_area_size()) &&
+                      m_master->merge(src, &diff, phandle_base);
+            if (pdiff)
+                *pdiff = diff;
+            put_layout(TRACE_MERGE, src, diff, ok);
+            return ok;
+        }
+
+    protected:
+        master_type *m_master;
+        FILE *m_fp;
+        uint64_t m_next_id;
+        std::unordered_map<size_type, uint64_t> m_ids;     // offset to id
+
+        void put_op(int op, bool ok)
+        {
+            std::fputc(op | (ok ? 0 : TRACE_FAILED), m_fp);
+        }
+        void add_block(void *ptr)
+        {
+            if (ptr)
+                m_ids[m_master->offset_from_ptr(ptr)] = m_next_id++;
+        }
+        // the valid blocks of the layout are at o + diff in the master
+        void put_layout(int op, const master_type& src, size_type diff, bool ok = true)
+        {
+            put_op(op, ok);
+            auto entries = src.get_entries();
+            auto num = src.num_entries();
+            detail::put_varint(m_fp, num);
+            for (auto i = num; i-- > 0; )
+            {
+                detail::put_varint(m_fp, entries[i].m_data_size);
+                auto flags = entries[i].m_flags & (entry_type::FLAG_VALID | entry_type::FLAG_ALIGNMENT_MASK);
+                std::fputc(flags, m_fp);
+                if (ok && entries[i].is_valid())
+                    m_ids[size_type(entries[i].m_offset + diff)] = m_next_id++;
+            }
+        }
+
+        // not copyable
+        RECORDER(const RECORDER&);
+        RECORDER& operator=(const RECORDER&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::FRAGMENTATION --- how the free space of a master is split
+
+    struct FRAGMENTATION
+    {
+        size_t m_holes;         // the number of the holes
+        size_t m_hole_bytes;    // the space of the holes
+        size_t m_free_area;     // the free area between the boundaries
+        size_t m_largest;       // the largest free space
+
+        // zero if the free space is in one piece
+        double ratio() const
+        {
+            size_t total = m_hole_bytes + m_free_area;
+            return total ? 1.0 - double(m_largest) / double(total) : 0.0;
+        }
+    };
+
+    template <typename T_SIZE>
+    inline FRAGMENTATION fragmentation(const MASTER<T_SIZE>& master)
+    {
+        FRAGMENTATION frag = { 0, 0, master.free_area_size(), master.free_area_size() };
+        auto entries = master.get_entries();
+        auto num = master.num_entries();
+        for (auto i = master.next_entry(0, false); i < num; i = master.next_entry(T_SIZE(i + 1), false))
+        {
+            // a run of the adjacent holes is one hole
+            auto last = T_SIZE(master.next_entry(i) - 1);
+            size_t space = master.entry_end(i) - entries[last].m_offset;
+            i = last;
+            ++frag.m_holes;
+            frag.m_hole_bytes += space;
+            if (space > frag.m_largest)
+                frag.m_largest = space;
+        }
+        return frag;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::read_trace_header(fp, header)
+    // EAT::replay<T_SIZE>(master, fp, result)
+    //
+    // NOTE: replay reads the records after the header and re-runs them on the
+    //       master. A call that failed in the trace but not in the replay is
+    //       undone, as the caller got NULL. replay returns false if the trace
+    //       is broken.
+
+    struct TRACE_HEADER
+    {
+        uint64_t m_total_size;
+        uint64_t m_alignment;
+    };
+
+    inline bool read_trace_header(FILE *fp, TRACE_HEADER& header)
+    {
+        char magic[sizeof(detail::TRACE_MAGIC)];
+        return std::fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+               std::memcmp(magic, detail::TRACE_MAGIC, sizeof(magic)) == 0 &&
+               std::fgetc(fp) == detail::TRACE_VERSION &&
+               detail::get_varint(fp, header.m_total_size) &&
+               detail::get_varint(fp, header.m_alignment);
+    }
+
+    struct REPLAY_RESULT
+    {
+        size_t m_calls[TRACE_NUM_OPS];      // the number of the calls
+        double m_ns[TRACE_NUM_OPS];         // the time in the calls
+        std::vector<size_t> m_failures;     // the indices of the failed calls
+        size_t m_recovered;                 // failed in the trace but not here
+        size_t m_peak_used;                 // the peak of used_area_size()
+        double m_worst_ratio;               // the worst fragmentation ratio
+        FRAGMENTATION m_final;              // the fragmentation at the end
+
+        REPLAY_RESULT() : m_recovered(0), m_peak_used(0), m_worst_ratio(0)
+        {
+            std::memset(m_calls, 0, sizeof(m_calls));
+            std::memset(m_ns, 0, sizeof(m_ns));
+            std::memset(&m_final, 0, sizeof(m_final));
+        }
+    };
+
+    template <typename T_SIZE>
+    inline bool replay(MASTER<T_SIZE> *master, FILE *fp, REPLAY_RESULT& result)
+    {
+        typedef std::chrono::steady_clock clock_type;
+        std::vector<T_SIZE> offsets;        // id to offset; zero if none
+        std::vector<T_SIZE> old_offsets, new_offsets;
+        std::vector<T_SIZE> sizes;
+        std::vector<uint8_t> flags;
+
+        auto fits = [](uint64_t value) { return value == uint64_t(T_SIZE(value)); };
+        auto get_offset = [&offsets](uint64_t id) -> T_SIZE {
+            return (id < offsets.size()) ? offsets[size_t(id)] : 0;
+        };
+        // read a layout of TRACE_BASE or TRACE_MERGE
+        auto get_layout = [&]() {
+            uint64_t count, siz;
+            sizes.clear();
+            flags.clear();
+            if (!detail::get_varint(fp, count))
+                return false;
+            for (uint64_t k = 0; k < count; ++k)
+            {
+                int ch;
+                if (!detail::get_varint(fp, siz) || (ch = std::fgetc(fp)) == EOF)
+                    return false;
+                sizes.push_back(T_SIZE(fits(siz) ? siz : 0));
+                flags.push_back(uint8_t(ch));
+            }
+            return true;
+        };
+        // allocate the layout in m and free its holes. returns false if failed.
+        auto put_layout = [&](MASTER<T_SIZE> *m, std::vector<void *>& ptrs) {
+            ptrs.assign(sizes.size(), NULL);
+            bool ok = true;
+            for (size_t k = 0; k < sizes.size() && ok; ++k)
+            {
+                T_SIZE align = T_SIZE(1) << ((flags[k] & ENTRY<T_SIZE>::FLAG_ALIGNMENT_MASK) >> 4);
+                bool offset_only = (flags[k] & ENTRY<T_SIZE>::FLAG_OFFSET_ALIGNED) != 0;
+                ptrs[k] = m->aligned_malloc_(sizes[k], align, offset_only);
+                ok = (ptrs[k] != NULL);
+            }
+            for (size_t k = 0; k < sizes.size(); ++k)
+            {
+                if (ptrs[k] && (!ok || !(flags[k] & ENTRY<T_SIZE>::FLAG_VALID)))
+                {
+                    m->free_(ptrs[k]);
+                    ptrs[k] = NULL;
+                }
+            }
+            return ok;
+        };
+
+        std::vector<void *> ptrs;
+        for (size_t index = 0; ; ++index)
+        {
+            int ch = std::fgetc(fp);
+            if (ch == EOF)
+                break; // the end
+            int op = ch & ~TRACE_FAILED;
+            bool failed = (ch & TRACE_FAILED) != 0;
+            uint64_t a = 0, b = 0;
+            switch (op)
+            {
+            case TRACE_MALLOC: case TRACE_CALLOC: case TRACE_REALLOC:
+                if (!detail::get_varint(fp, a) || !detail::get_varint(fp, b))
+                    return false;
+                break;
+            case TRACE_FREE:
+                if (!detail::get_varint(fp, a))
+                    return false;
+                break;
+            case TRACE_BASE: case TRACE_MERGE:
+                if (!get_layout())
+                    return false;
+                break;
+            case TRACE_COMPACT:
+                break;
+            default:
+                return false; // unknown
+            }
+
+            bool ok = true;
+            auto start = clock_type::now();
+            switch (op)
+            {
+            case TRACE_BASE:
+                ok = put_layout(master, ptrs);
+                for (size_t k = 0; k < ptrs.size(); ++k)
+                {
+                    if (flags[k] & ENTRY<T_SIZE>::FLAG_VALID)
+                        offsets.push_back(ptrs[k] ? master->offset_from_ptr(ptrs[k]) : 0);
+                }
+                break;
+            case TRACE_MALLOC: case TRACE_CALLOC:
+                {
+                    void *ptr = NULL;
+                    if (op == TRACE_MALLOC && fits(a) && b < 8 * sizeof(T_SIZE))
+                        ptr = master->aligned_malloc_(T_SIZE(a), T_SIZE(T_SIZE(1) << b));
+                    else if (op == TRACE_CALLOC && fits(a) && fits(b) && fits(a * b))
+                        ptr = master->calloc_(T_SIZE(a), T_SIZE(b));
+                    ok = (ptr != NULL);
+                    if (failed && ptr)
+                        master->free_(ptr); // the caller got NULL
+                    else if (!failed)
+                        offsets.push_back(ptr ? master->offset_from_ptr(ptr) : 0);
+                }
+                break;
+            case TRACE_REALLOC:
+                {
+                    auto offset = get_offset(a);
+                    if (!offset)
+                    {
+                        ok = !failed;
+                        break; // lost before
+                    }
+                    void *ptr = NULL;
+                    if (!failed && fits(b))
+                        ptr = master->realloc_(master->ptr_from_offset(offset), T_SIZE(b));
+                    ok = (ptr != NULL); // a failed one is not replayed, nor recovered
+                    if (ptr)
+                        offsets[size_t(a)] = master->offset_from_ptr(ptr);
+                }
+                break;
+            case TRACE_FREE:
+                if (auto offset = get_offset(a))
+                {
+                    master->free_(master->ptr_from_offset(offset));
+                    offsets[size_t(a)] = 0;
+                }
+                break;
+            case TRACE_COMPACT:
+                detail::valid_offsets(*master, old_offsets);
+                master->compact();
+                detail::valid_offsets(*master, new_offsets);
+                for (auto& offset : offsets)
+                {
+                    if (offset)
+                        offset = detail::compacted_offset(old_offsets, new_offsets, offset);
+                }
+                break;
+            case TRACE_MERGE:
+                if (failed)
+                {
+                    ok = false; // nothing merged in the trace; a merge cannot be undone
+                    break;
+                }
+                {
+                    size_t room = master->head_size(), align = 1;
+                    for (size_t k = 0; k < sizes.size(); ++k)
+                    {
+                        room += sizes[k] + master->entry_size() + (size_t(1) << (flags[k] >> 4));
+                        if (!(flags[k] & ENTRY<T_SIZE>::FLAG_OFFSET_ALIGNED))
+                            align = std::max(align, size_t(1) << (flags[k] >> 4));
+                    }
+                    MASTER<T_SIZE> *src = fits(room) ? create_master<T_SIZE>(room, align) : NULL;
+                    T_SIZE diff = 0;
+                    ok = src && put_layout(src, ptrs) && master->merge_room(*src) <= master->free_area_size() &&
+                         master->merge(*src, &diff);
+                    for (size_t k = 0; k < ptrs.size(); ++k)
+                    {
+                        if (flags[k] & ENTRY<T_SIZE>::FLAG_VALID)
+                            offsets.push_back(ok ? T_SIZE(src->offset_from_ptr(ptrs[k]) + diff) : 0);
+                    }
+                    destroy_master(src);
+                }
+                break;
+            }
+            auto end = clock_type::now();
+
+            ++result.m_calls[op];
+            result.m_ns[op] += double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            if (!ok && !failed)
+                result.m_failures.push_back(index);
+            if (ok && failed)
+                ++result.m_recovered;
+            if (master->used_area_size() > result.m_peak_used)
+                result.m_peak_used = master->used_area_size();
+            if (index % 4096 == 0)
+                result.m_worst_ratio = std::max(result.m_worst_ratio, fragmentation(*master).ratio());
+        }
+
+        result.m_final = fragmentation(*master);
+        result.m_worst_ratio = std::max(result.m_worst_ratio, result.m_final.ratio());
+        return true;
+    }
+} // namespace EAT
+
+#endif  // ndef EYEBALL_ALLOCATION_TABLE_TRACE
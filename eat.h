@@ -3,19 +3,50 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #ifndef EYEBALL_ALLOCATION_TABLE
-#define EYEBALL_ALLOCATION_TABLE    3  // Version 3
+#define EYEBALL_ALLOCATION_TABLE    5  // Version 5
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <cstddef>
 #include <cassert>
+#include <algorithm>
+#include <functional>
+#ifdef _WIN32
+    #include <malloc.h>     // _aligned_malloc
+#endif
+
+// the largest alignment of a block
+#ifndef EAT_MASTER_ALIGNMENT
+    #define EAT_MASTER_ALIGNMENT    4096
+#endif
+
+#if !defined(EAT_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || \
+                              defined(__i386__) || defined(_M_IX86))
+    #define EAT_SIMD_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define EAT_TARGET(name)
+    #else
+        #define EAT_TARGET(name) __attribute__((target(name)))
+    #endif
+#endif
 
 namespace EAT
 {
     //////////////////////////////////////////////////////////////////////////
     // EAT::ENTRY<T_SIZE> --- memory block info entry
+    //
+    // NOTE: Since version 5, the flags take one byte and the entry has no
+    //       padding, so that an entry of uint32_t takes 9 bytes, not 12.
+    //       The flags need 7 bits, and the offset and the size have no bits
+    //       to spare in a full-sized image, so they are kept apart. The
+    //       table stays an array of entries; it grows down from boundary_2
+    //       as one run, and insert_entry and compact move one run only.
 
+#pragma pack(push, 1)
     template <typename T_SIZE>
     struct ENTRY
     {
@@ -27,13 +58,15 @@ namespace EAT
         {
             FLAG_NONE = 0,
             FLAG_VALID = 1,
-            FLAG_LOCKED = 2
+            FLAG_LOCKED = 2,
+            FLAG_OFFSET_ALIGNED = 4,    // the offset only is aligned
+            FLAG_ALIGNMENT_MASK = 0xF0  // log2 of the alignment
         };
 
         // Members
         size_type           m_data_size;
         size_type           m_offset;
-        size_type           m_flags;
+        uint8_t             m_flags;
 
         // Constructors
         ENTRY(size_type data_area_size, size_type offset)
@@ -45,7 +78,7 @@ namespace EAT
         ENTRY(size_type data_area_size, size_type offset, size_type flags)
             : m_data_size(data_area_size)
             , m_offset(offset)
-            , m_flags(flags)
+            , m_flags(uint8_t(flags))
         {
         }
 
@@ -73,7 +106,380 @@ namespace EAT
             else
                 m_flags &= ~FLAG_LOCKED;
         }
+        bool is_offset_aligned() const
+        {
+            return ((m_flags & FLAG_OFFSET_ALIGNED) != 0);
+        }
+        size_type alignment() const
+        {
+            return size_type(1) << ((m_flags & FLAG_ALIGNMENT_MASK) >> 4);
+        }
+        static size_type alignment_flags(size_type alignment)
+        {
+            size_type shift = 0;
+            while ((size_type(1) << shift) < alignment)
+                ++shift;
+            return size_type(shift << 4);
+        }
     }; // EAT::ENTRY<T_SIZE>
+#pragma pack(pop)
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::ENTRY_V4<T_SIZE> --- the entry until version 4, for upgrade
+
+    template <typename T_SIZE>
+    struct ENTRY_V4
+    {
+        T_SIZE              m_data_size;
+        T_SIZE              m_offset;
+        T_SIZE              m_flags;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::detail::find_flag<T_SIZE>(entries, first, last, bit, set)
+    // EAT::detail::rfind_flag<T_SIZE>(entries, first, last, bit, set)
+    //
+    // NOTE: They find the first (or the last) entry in [first, last) whose
+    //       flag bit is set (or clear), or return NOT_FOUND. The SSE2 and the
+    //       AVX2 kernels test 16 or 32 bytes of the table at once. The flag
+    //       bytes come at every sizeof(ENTRY) bytes, so a bit mask of their
+    //       positions is kept for each phase. The kernel is chosen by CPUID
+    //       at the first call, for uint16_t and uint32_t (see simd_kernel).
+    //       The 17-byte entries of uint64_t scan with the scalar code, which
+    //       is as fast below 100K entries. Define EAT_NO_SIMD to use the
+    //       scalar code only.
+
+    namespace detail
+    {
+        enum SIMD_LEVEL
+        {
+            SIMD_NONE,
+            SIMD_SSE2,
+            SIMD_AVX2
+        };
+
+        static const size_t NOT_FOUND = size_t(-1);
+
+        inline int detect_simd_level()
+        {
+#ifdef EAT_SIMD_X86
+    #if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            int max_id = info[0];
+            __cpuid(info, 1);
+            bool sse2 = (info[3] & (1 << 26)) != 0;
+            bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                       (_xgetbv(0) & 6) == 6; // OSXSAVE, AVX and the YMM state
+            if (avx && max_id >= 7)
+            {
+                __cpuidex(info, 7, 0);
+                if (info[1] & (1 << 5))
+                    return SIMD_AVX2;
+            }
+            return sse2 ? SIMD_SSE2 : SIMD_NONE;
+    #else
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return SIMD_AVX2;
+            if (__builtin_cpu_supports("sse2"))
+                return SIMD_SSE2;
+    #endif
+#endif
+            return SIMD_NONE;
+        }
+
+        // the kernel in use. it can be lowered for testing.
+        inline int& simd_level()
+        {
+            static int s_level = detect_simd_level();
+            return s_level;
+        }
+
+        template <typename T_SIZE>
+        inline size_t find_flag_scalar(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                       uint8_t bit, bool set)
+        {
+            for (size_t i = first; i < last; ++i)
+            {
+                if (((entries[i].m_flags & bit) != 0) == set)
+                    return i;
+            }
+            return NOT_FOUND;
+        }
+        template <typename T_SIZE>
+        inline size_t rfind_flag_scalar(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                        uint8_t bit, bool set)
+        {
+            for (size_t i = last; i-- > first; )
+            {
+                if (((entries[i].m_flags & bit) != 0) == set)
+                    return i;
+            }
+            return NOT_FOUND;
+        }
+
+#ifdef EAT_SIMD_X86
+        // the positions of the flag bytes in the windows of a period. a
+        // period of STRIDE windows of W bytes covers W entries, so the k-th
+        // window from the start (or the end) of a period has a fixed mask.
+        template <typename T_SIZE>
+        struct FLAG_MASKS
+        {
+            enum { STRIDE = sizeof(ENTRY<T_SIZE>) };
+            uint32_t m_forward16[STRIDE], m_backward16[STRIDE];
+            uint32_t m_forward32[STRIDE], m_backward32[STRIDE];
+
+            FLAG_MASKS()
+            {
+                for (size_t k = 0; k < STRIDE; ++k)
+                {
+                    m_forward16[k] = mask_at(16 * k, 16);
+                    m_backward16[k] = mask_at(16 * (STRIDE - 1 - k), 16);
+                    m_forward32[k] = mask_at(32 * k, 32);
+                    m_backward32[k] = mask_at(32 * (STRIDE - 1 - k), 32);
+                }
+            }
+            // bit j: the byte j of the window at the offset is a flag byte
+            static uint32_t mask_at(size_t offset, size_t width)
+            {
+                const size_t pos = offsetof(ENTRY<T_SIZE>, m_flags);
+                uint32_t mask = 0;
+                for (size_t j = 0; j < width; ++j)
+                {
+                    if ((offset + j) % STRIDE == pos)
+                        mask |= uint32_t(1) << j;
+                }
+                return mask;
+            }
+            static const FLAG_MASKS& get()
+            {
+                static const FLAG_MASKS s_masks;
+                return s_masks;
+            }
+        };
+
+        inline size_t lowest_bit(uint32_t bits)
+        {
+    #if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanForward(&index, bits);
+            return index;
+    #else
+            return size_t(__builtin_ctz(bits));
+    #endif
+        }
+        inline size_t highest_bit(uint32_t bits)
+        {
+    #if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanReverse(&index, bits);
+            return index;
+    #else
+            return size_t(31 - __builtin_clz(bits));
+    #endif
+        }
+
+        template <typename T_SIZE>
+        EAT_TARGET("sse2")
+        inline size_t find_flag_sse2(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                     uint8_t bit, bool set)
+        {
+            typedef FLAG_MASKS<T_SIZE> masks_type;
+            const size_t stride = masks_type::STRIDE, period = 16 * stride;
+            auto& masks = masks_type::get();
+            auto base = reinterpret_cast<const char *>(entries);
+            auto vbit = _mm_set1_epi8(char(bit));
+            auto vwant = set ? vbit : _mm_setzero_si128();
+            size_t byte = first * stride, end = last * stride;
+            for (; byte + period <= end; byte += period)
+            {
+                for (size_t k = 0; k < stride; ++k)
+                {
+                    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + byte + 16 * k));
+                    auto eq = _mm_cmpeq_epi8(_mm_and_si128(chunk, vbit), vwant);
+                    auto hits = uint32_t(_mm_movemask_epi8(eq)) & masks.m_forward16[k];
+                    if (hits)
+                        return (byte + 16 * k + lowest_bit(hits)) / stride;
+                }
+            }
+            return find_flag_scalar(entries, byte / stride, last, bit, set);
+        }
+        template <typename T_SIZE>
+        EAT_TARGET("sse2")
+        inline size_t rfind_flag_sse2(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                      uint8_t bit, bool set)
+        {
+            typedef FLAG_MASKS<T_SIZE> masks_type;
+            const size_t stride = masks_type::STRIDE, period = 16 * stride;
+            auto& masks = masks_type::get();
+            auto base = reinterpret_cast<const char *>(entries);
+            auto vbit = _mm_set1_epi8(char(bit));
+            auto vwant = set ? vbit : _mm_setzero_si128();
+            size_t begin = first * stride, byte = last * stride;
+            for (; byte >= begin + period; byte -= period)
+            {
+                for (size_t k = 0; k < stride; ++k)
+                {
+                    auto window = byte - 16 * (k + 1);
+                    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + window));
+                    auto eq = _mm_cmpeq_epi8(_mm_and_si128(chunk, vbit), vwant);
+                    auto hits = uint32_t(_mm_movemask_epi8(eq)) & masks.m_backward16[k];
+                    if (hits)
+                        return (window + highest_bit(hits)) / stride;
+                }
+            }
+            return rfind_flag_scalar(entries, first, byte / stride, bit, set);
+        }
+
+        template <typename T_SIZE>
+        EAT_TARGET("avx2")
+        inline size_t find_flag_avx2(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                     uint8_t bit, bool set)
+        {
+            typedef FLAG_MASKS<T_SIZE> masks_type;
+            const size_t stride = masks_type::STRIDE, period = 32 * stride;
+            auto& masks = masks_type::get();
+            auto base = reinterpret_cast<const char *>(entries);
+            auto vbit = _mm256_set1_epi8(char(bit));
+            auto vwant = set ? vbit : _mm256_setzero_si256();
+            size_t byte = first * stride, end = last * stride;
+            for (; byte + period <= end; byte += period)
+            {
+                for (size_t k = 0; k < stride; ++k)
+                {
+                    auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + byte + 32 * k));
+                    auto eq = _mm256_cmpeq_epi8(_mm256_and_si256(chunk, vbit), vwant);
+                    auto hits = uint32_t(_mm256_movemask_epi8(eq)) & masks.m_forward32[k];
+                    if (hits)
+                        return (byte + 32 * k + lowest_bit(hits)) / stride;
+                }
+            }
+            return find_flag_scalar(entries, byte / stride, last, bit, set);
+        }
+        template <typename T_SIZE>
+        EAT_TARGET("avx2")
+        inline size_t rfind_flag_avx2(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                      uint8_t bit, bool set)
+        {
+            typedef FLAG_MASKS<T_SIZE> masks_type;
+            const size_t stride = masks_type::STRIDE, period = 32 * stride;
+            auto& masks = masks_type::get();
+            auto base = reinterpret_cast<const char *>(entries);
+            auto vbit = _mm256_set1_epi8(char(bit));
+            auto vwant = set ? vbit : _mm256_setzero_si256();
+            size_t begin = first * stride, byte = last * stride;
+            for (; byte >= begin + period; byte -= period)
+            {
+                for (size_t k = 0; k < stride; ++k)
+                {
+                    auto window = byte - 32 * (k + 1);
+                    auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + window));
+                    auto eq = _mm256_cmpeq_epi8(_mm256_and_si256(chunk, vbit), vwant);
+                    auto hits = uint32_t(_mm256_movemask_epi8(eq)) & masks.m_backward32[k];
+                    if (hits)
+                        return (window + highest_bit(hits)) / stride;
+                }
+            }
+            return rfind_flag_scalar(entries, first, byte / stride, bit, set);
+        }
+
+#endif  // def EAT_SIMD_X86
+
+        // the kernel for the entries of T_SIZE, at or below the level
+        template <typename T_SIZE>
+        inline int simd_kernel(int level)
+        {
+#ifdef EAT_SIMD_X86
+            if (sizeof(ENTRY<T_SIZE>) > 16)
+                return SIMD_NONE; // a window holds one or two flags of uint64_t
+            return level;
+#else
+            return SIMD_NONE;
+#endif
+        }
+
+        template <typename T_SIZE>
+        inline size_t find_flag(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                uint8_t bit, bool set)
+        {
+#ifdef EAT_SIMD_X86
+            switch (simd_kernel<T_SIZE>(simd_level()))
+            {
+            case SIMD_AVX2:
+                return find_flag_avx2(entries, first, last, bit, set);
+            case SIMD_SSE2:
+                return find_flag_sse2(entries, first, last, bit, set);
+            }
+#endif
+            return find_flag_scalar(entries, first, last, bit, set);
+        }
+        template <typename T_SIZE>
+        inline size_t rfind_flag(const ENTRY<T_SIZE> *entries, size_t first, size_t last,
+                                 uint8_t bit, bool set)
+        {
+#ifdef EAT_SIMD_X86
+            switch (simd_kernel<T_SIZE>(simd_level()))
+            {
+            case SIMD_AVX2:
+                return rfind_flag_avx2(entries, first, last, bit, set);
+            case SIMD_SSE2:
+                return rfind_flag_sse2(entries, first, last, bit, set);
+            }
+#endif
+            return rfind_flag_scalar(entries, first, last, bit, set);
+        }
+
+        inline bool is_aligned_ptr(const void *ptr, size_t align)
+        {
+            return (reinterpret_cast<uintptr_t>(ptr) & (align - 1)) == 0;
+        }
+
+        // run job(0), ..., job(count - 1) one by one
+        struct SERIAL_RUNNER
+        {
+            template <typename T_JOB>
+            void operator()(size_t count, T_JOB& job) const
+            {
+                for (size_t k = 0; k < count; ++k)
+                {
+                    job(k);
+                }
+            }
+        };
+    } // namespace detail
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::STATS --- the statistics of a master
+    //
+    // NOTE: The stats block is a system block of the master, enabled by
+    //       MASTER::enable_stats. The counters are plain (not atomic) like the
+    //       master itself, and are saved with the image. Define EAT_NO_STATS
+    //       to compile out the counting.
+    //       A block is live if its entry is valid. The dead bytes are the
+    //       rest of the data area, that is, the holes and the padding.
+    //       The system blocks (the tables, the directories and the dirty
+    //       map) are live, but their allocations are not in m_allocs and
+    //       m_frees, so that the counters describe the calls of the user.
+
+    struct STATS
+    {
+        uint64_t m_allocs;          // the allocated blocks, also by realloc_
+        uint64_t m_frees;           // the freed blocks, also by realloc_
+        uint64_t m_reallocs;        // the calls of realloc_
+        uint64_t m_failed;          // the failed allocations
+        uint64_t m_fetches;         // the calls of fetch_entry
+        uint64_t m_probes;          // the steps of the binary search in fetch_entry
+        uint64_t m_moved;           // the bytes moved by compact and compact_step
+        uint64_t m_auto_compacts;   // the compactions by auto_compact
+        uint64_t m_peak_used;       // the peak of used_area_size()
+        uint64_t m_live_bytes;      // the sizes of the live blocks
+        uint64_t m_live_entries;    // the number of the live blocks
+        uint64_t m_compact_percent; // the dead bytes to compact, or zero
+        uint64_t m_compact_min;     // the least dead bytes to compact
+        uint64_t m_system_allocs;   // the system blocks allocated, apart from m_allocs
+        uint64_t m_system_frees;    // the system blocks freed, apart from m_frees
+    };
 
     //////////////////////////////////////////////////////////////////////////
     // EAT::HEAD<T_SIZE> --- the header data
@@ -85,7 +491,8 @@ namespace EAT
         typedef T_SIZE                          size_type;
         enum FLAGS
         {
-            SIZE_TYPE_SIZE_MASK = 0x000000FFUL,
+            SIZE_TYPE_SIZE_MASK = 0x0000000FUL,
+            ALIGNMENT_MASK      = 0x000000F0UL, // log2 of the default alignment
             FLAG_INVALID        = 0x00000100UL,
             FLAG_HIDDEN         = 0x00000200UL,
             FLAG_MOVEABLE       = 0x00000400UL,
@@ -113,16 +520,26 @@ namespace EAT
         };
 
         // Members
-        char        m_magic[4];         // must be "EAT\0"
+        char        m_magic[4];         // must be "EAT" + version
         uint32_t    m_flags;
         size_type   m_total_size;
         size_type   m_boudary_1;
         size_type   m_boudary_2;
+        // since version 4
+        size_type   m_handles;          // offset of the handle table or zero
+        size_type   m_compacted;        // the data below it is compact
+        size_type   m_epoch;            // counts the changes a release cannot undo
+        size_type   m_mark;             // boundary_1 at the innermost mark or zero
+        size_type   m_dirty;            // offset of the dirty map or zero
+        size_type   m_stats;            // offset of the stats block or zero
+        size_type   m_names;            // offset of the name directory or zero
+        size_type   m_slabs;            // offset of the slab directory or zero
 
         // Attributes
         bool is_valid() const
         {
-            return ((memcmp(m_magic, "EAT\0", 4) == 0) &&
+            return ((memcmp(m_magic, "EAT", 3) == 0) &&
+                    (version() == EYEBALL_ALLOCATION_TABLE) &&
                     (size_type_size() == size_type(sizeof(size_type))) &&
                     (!(m_flags & FLAG_INVALID)) &&
                     (m_boudary_1 <= m_boudary_2) &&
@@ -140,6 +557,21 @@ namespace EAT
         {
             return size_type(m_flags & SIZE_TYPE_SIZE_MASK);
         }
+        size_type alignment() const
+        {
+            return size_type(1) << ((m_flags & ALIGNMENT_MASK) >> 4);
+        }
+        int version() const
+        {
+            if (m_magic[3] == 0)
+                return 3; // "EAT\0"
+            return m_magic[3];
+        }
+        // the size of the header of version 3
+        static size_type v3_head_size()
+        {
+            return size_type(offsetof(HEAD, m_handles));
+        }
         void modify_flags(uint32_t add_, uint32_t remove_)
         {
             m_flags &= ~remove_;
@@ -176,8 +608,32 @@ namespace EAT
     //             |ENTRY #0                   |
     //             +---------------------------+(bottom)
     //
+    // NOTE: get_entries()[0] is the entry at boundary_2, that is, the newest
+    //       one. Every operation keeps the table sorted by m_offset in
+    //       descending order (the newer, the higher), so an entry can be
+    //       looked up by binary search.
+    //
+    //       The data of ENTRY #i may be followed by some unused bytes up to
+    //       the data of ENTRY #i-1 (or boundary_1). An invalid entry is a
+    //       hole that malloc_ can reuse. Adjacent holes are coalesced lazily;
+    //       free_ only marks the entry, and reuse_hole, resize_in_place and
+    //       compact take a run of the holes as one hole.
+    //
+    //       The alignment of a block is the alignment of its offset, so the
+    //       image itself must be placed at an address aligned as strictly.
+    //       aligned_malloc_ and merge fail if it is not. create_master places
+    //       the image at alignof(std::max_align_t) unless asked for more, and
+    //       mmap at a page. resize_master, read_master and widen_master keep
+    //       image_alignment(). The alignment is recorded in the entry so that
+    //       compact and merge can keep it. A slab needs its offset aligned
+    //       only; its entry is marked FLAG_OFFSET_ALIGNED and is left out of
+    //       image_alignment().
+    //
     //////////////////////////////////////////////////////////////////////////
 
+    template <typename T_SIZE>
+    struct CONCURRENT;
+
     template <typename T_SIZE>
     struct MASTER : protected HEAD<T_SIZE>
     {
@@ -187,6 +643,10 @@ namespace EAT
         typedef HEAD<T_SIZE>      head_type;
         typedef ENTRY<T_SIZE>     entry_type;
 
+        friend struct CONCURRENT<T_SIZE>;
+        template <typename T_OTHER>
+        friend struct MASTER;
+
         // Constructors
         MASTER(size_type total_size)
         {
@@ -224,22 +684,46 @@ namespace EAT
             return true;
         }
 
-        // Merge
-        bool merge(const MASTER<T_SIZE>& src)
+        // Merge.
+        // a source offset o becomes o + *pdiff, and a source handle h
+        // becomes h + *phandle_base.
+        bool merge(const MASTER<T_SIZE>& src, size_type *pdiff = NULL,
+                   size_type *phandle_base = NULL)
         {
             assert(is_valid());
             assert(src.is_valid());
 
             if (this == &src)
                 return true; // same
+            if (!slabs_mergeable(src))
+                return false; // another slab size
+            if (!detail::is_aligned_ptr(this, src.address_alignment()))
+                return false; // the image is not aligned for the source blocks
+            if (merge_room(src) > free_area_size())
+                return false; // no room; nothing is changed
 
             // not same
-            size_type addition = src.used_area_size() - src.head_size();
-            assert(addition <= free_area_size());
-            if (addition > free_area_size())
+            // make room for the source handles first
+            size_type handle_base = handle_capacity();
+            if (handle_base && src.handle_capacity())
+            {
+                if (!grow_handles(size_type(handle_base + src.handle_capacity())))
+                    return false; // not mergeable
+            }
+
+            // the data must be shifted by a multiple of the source alignment
+            auto entries2 = src.get_entries();
+            auto align = src.max_alignment();
+            auto pad = size_type(align_up(data_area_size(), align) - data_area_size());
+
+            size_type addition = size_type(src.used_area_size() - src.head_size());
+            assert(addition <= free_area_size() && pad <= free_area_size() - addition);
+            if (addition > free_area_size() || pad > free_area_size() - addition)
                 return false; // not mergeable
 
+            head_type::m_boudary_1 += pad;
             auto diff = size_type(head_type::m_boudary_1 - src.head_size());
+            allocated_at(head_type::m_boudary_1);
 
             // add data
             auto data_size_2 = src.data_area_size();
@@ -250,7 +734,6 @@ namespace EAT
             auto num = src.num_entries();
             auto entries1 = get_entries();
             entries1 -= num;
-            auto entries2 = src.get_entries();
             for (size_type i = 0; i < num; ++i)
             {
                 entries1[i].m_data_size = entries2[i].m_data_size;
@@ -258,20 +741,229 @@ namespace EAT
                 entries1[i].m_flags = entries2[i].m_flags;
             }
             head_type::m_boudary_2 -= size_type(num * entry_size());
+            dirty_range(size_type(diff + src.head_size()), data_size_2);
+            dirty_table(size_type(head_type::m_boudary_2 + num * entry_size()));
+
+            count_merged(src);
+            merge_handles(src, diff, handle_base);
+            merge_names(src, diff, handle_base);
+            merge_slabs(src, diff, handle_base);
+            free_system_copies(src, diff);
+            if (pdiff)
+                *pdiff = diff;
+            if (phandle_base)
+                *phandle_base = (src.handle_capacity() ? handle_base : 0);
 
             assert(is_valid());
             assert(src.is_valid());
             return true;
         }
 
+        // the free area that merge(src) needs at most
+        size_t merge_room(const MASTER<T_SIZE>& src) const
+        {
+            size_t room = size_t(src.used_area_size() - src.head_size()) + src.max_alignment() - 1;
+            if (handle_capacity() && src.handle_capacity())
+            {
+                size_t capacity = size_t(handle_capacity()) + src.handle_capacity();
+                room += (capacity * 2 + 2) * sizeof(size_type) + entry_size() + sizeof(size_type) - 1;
+            }
+            if (src.num_names())
+                room += names_room(size_t(num_names()) + src.num_names());
+            if (src.has_slabs() && !has_slabs())
+                room += slabs_room();
+            return room;
+        }
+
+        // the free area that merge_many(srcs, n) needs at most,
+        // or size_t(-1) if they cannot be merged
+        size_t merge_room(const MASTER<T_SIZE> *const *srcs, size_t n) const
+        {
+            size_t room = 0, handles = 0, names = 0;
+            for (size_t k = 0; k < n; ++k)
+            {
+                room += size_t(srcs[k]->used_area_size() - srcs[k]->head_size()) +
+                        srcs[k]->max_alignment() - 1;
+                handles += srcs[k]->handle_capacity();
+                names += srcs[k]->num_names();
+            }
+            if (names)
+                room += names_room(num_names() + names);
+            if (!has_slabs())
+            {
+                for (size_t k = 0; k < n; ++k)
+                {
+                    if (srcs[k]->has_slabs())
+                    {
+                        room += slabs_room();
+                        break;
+                    }
+                }
+            }
+            if (handles)
+            {
+                size_t capacity = size_t(handle_capacity()) + handles;
+                if (capacity != size_type(capacity))
+                    return size_t(-1); // too many handles
+                room += (capacity * 2 + 2) * sizeof(size_type) + entry_size() + sizeof(size_type) - 1;
+            }
+            return room;
+        }
+
+        // Merge n sources at once with one room check, copying the data areas
+        // and the tables in bulk. A source offset o of srcs[k] becomes
+        // o + diffs[k], and a source handle h becomes h + handle_bases[k].
+        // drop_invalid drops the holes of the sources; their space is left
+        // unused until compact.
+        bool merge_many(const MASTER<T_SIZE> *const *srcs, size_t n, size_type *diffs = NULL,
+                        size_type *handle_bases = NULL, bool drop_invalid = false)
+        {
+            detail::SERIAL_RUNNER run_fn;
+            return merge_many(srcs, n, run_fn, diffs, handle_bases, drop_invalid);
+        }
+
+        // callback: void T_RUN_FN(size_t count, T_JOB& job);
+        // it runs job(0), ..., job(count - 1), a job for each source.
+        template <typename T_RUN_FN>
+        bool merge_many(const MASTER<T_SIZE> *const *srcs, size_t n, T_RUN_FN& run_fn,
+                        size_type *diffs = NULL, size_type *handle_bases = NULL,
+                        bool drop_invalid = false)
+        {
+            assert(is_valid());
+            for (size_t k = 0; k < n; ++k)
+            {
+                assert(srcs[k]->is_valid());
+                if (srcs[k] == this)
+                    return false; // cannot merge itself
+                if (!slabs_mergeable(*srcs[k]))
+                    return false; // another slab size
+                if (!detail::is_aligned_ptr(this, srcs[k]->address_alignment()))
+                    return false; // the image is not aligned for the source blocks
+                for (size_t m = 0; m < k; ++m)
+                {
+                    if (!srcs[m]->slabs_mergeable(*srcs[k]))
+                        return false;
+                }
+            }
+            if (merge_room(srcs, n) > free_area_size())
+                return false; // no room
+
+            // make room for the source handles first
+            size_t handle_base = handle_capacity(), handles = 0;
+            for (size_t k = 0; k < n; ++k)
+            {
+                handles += srcs[k]->handle_capacity();
+            }
+            if (handles && !grow_handles(size_type(handle_base + handles)))
+                return false; // out of memory
+
+            // lay out the data from boundary_1 and the tables from boundary_2
+            auto layout = reinterpret_cast<size_t *>(std::malloc((2 * n + 1) * sizeof(size_t)));
+            if (!layout)
+                return false; // out of memory
+            size_t cursor = head_type::m_boudary_1, table = head_type::m_boudary_2;
+            for (size_t k = 0; k < n; ++k)
+            {
+                auto& src = *srcs[k];
+                // the data must be shifted by a multiple of the source alignment
+                if (src.data_area_size())
+                    cursor = head_size() + align_up_size(cursor - head_size(), src.max_alignment());
+                layout[2 * k] = cursor - src.head_size();
+                cursor += src.data_area_size();
+
+                size_t count = src.num_entries();
+                if (drop_invalid)
+                {
+                    for (auto i = src.next_entry(0, false); i < src.num_entries();
+                         i = src.next_entry(size_type(i + 1), false))
+                    {
+                        --count;
+                    }
+                }
+                table -= count * entry_size();
+                layout[2 * k + 1] = table;
+            }
+            assert(cursor <= table);
+
+            // copy
+            auto job = [this, srcs, layout, drop_invalid](size_t k) {
+                auto& src = *srcs[k];
+                auto diff = size_type(layout[2 * k]);
+                std::memcpy(ptr_from_offset(size_type(diff + src.head_size())),
+                            src.get_data_area(), src.data_area_size());
+
+                auto entries = src.get_entries();
+                auto dest = reinterpret_cast<entry_type *>(ptr_from_offset(size_type(layout[2 * k + 1])));
+                auto num = src.num_entries();
+                if (drop_invalid)
+                {
+                    for (auto i = src.next_entry(0); i < num; i = src.next_entry(size_type(i + 1)))
+                    {
+                        *dest = entries[i];
+                        dest->m_offset = size_type(dest->m_offset + diff);
+                        ++dest;
+                    }
+                    return;
+                }
+                std::memcpy(dest, entries, num * entry_size());
+                for (size_type i = 0; i < num; ++i)
+                {
+                    dest[i].m_offset = size_type(dest[i].m_offset + diff);
+                }
+            };
+            run_fn(n, job);
+
+            auto old_b1 = head_type::m_boudary_1, old_b2 = head_type::m_boudary_2;
+            allocated_at(old_b1);
+            head_type::m_boudary_1 = size_type(cursor);
+            head_type::m_boudary_2 = size_type(table);
+            dirty_range(old_b1, cursor - old_b1);
+            dirty_table(old_b2);
+
+            // take over the handles and the names, and free the copies of the
+            // system blocks
+            size_t names = num_names();
+            for (size_t k = 0; k < n; ++k)
+            {
+                names += srcs[k]->num_names();
+            }
+            if (names)
+            {
+                bool reserved = reserve_names(names); // at once
+                assert(reserved); // merge_room has made room
+                (void)reserved;
+            }
+            for (size_t k = 0; k < n; ++k)
+            {
+                auto& src = *srcs[k];
+                auto diff = size_type(layout[2 * k]);
+                count_merged(src);
+                merge_handles(src, diff, size_type(handle_base));
+                merge_names(src, diff, size_type(handle_base));
+                merge_slabs(src, diff, size_type(handle_base));
+                free_system_copies(src, diff);
+                if (diffs)
+                    diffs[k] = diff;
+                if (handle_bases)
+                    handle_bases[k] = (src.handle_capacity() ? size_type(handle_base) : 0);
+                handle_base += src.handle_capacity();
+            }
+
+            std::free(layout);
+            assert(is_valid());
+            return true;
+        }
+
         // initialize
         void init(size_t total_size)
         {
-            std::memcpy(head_type::m_magic, "EAT\0", 4);
+            std::memcpy(head_type::m_magic, "EAT", 3);
+            head_type::m_magic[3] = char(EYEBALL_ALLOCATION_TABLE);
             head_type::m_flags = size_type_size();
             head_type::m_total_size = total_size;
             head_type::m_boudary_1 = head_size();
             head_type::m_boudary_2 = total_size;
+            clear_roots();
             assert(is_valid());
         }
         void clear(bool fill_by_zero = true)
@@ -279,40 +971,299 @@ namespace EAT
             assert(is_valid());
             head_type::m_boudary_1 = head_size();
             head_type::m_boudary_2 = head_type::m_total_size;
+            auto epoch = head_type::m_epoch, mark = head_type::m_mark; // the marks survive
+            clear_roots();
+            head_type::m_epoch = epoch;
+            head_type::m_mark = mark;
             if (fill_by_zero)
                 std::memset(get_free_area(), 0, free_area_size());
             assert(is_valid());
         }
 
-        // index access
-        void *operator[](size_type index)
-        {
-            return reinterpret_cast<uint8_t *>(this)[index];
-        }
-        const void *operator[](size_type index) const
+        // reset the header fields since version 4
+        void clear_roots()
         {
-            return reinterpret_cast<const uint8_t *>(this)[index];
+            head_type::m_handles = 0;
+            head_type::m_compacted = 0;
+            head_type::m_epoch = 0;
+            head_type::m_mark = 0;
+            head_type::m_dirty = 0;
+            head_type::m_stats = 0;
+            head_type::m_names = 0;
+            head_type::m_slabs = 0;
         }
-        size_type size() const
+
+        // upgrade the image of an older version in place.
+        // returns false if broken; a broken image that was changed is marked
+        // FLAG_INVALID, so that it is refused from then on.
+        bool upgrade()
         {
-            return head_type::m_total_size;
+            if (is_valid())
+                return is_sorted_table(); // up to date
+            auto version = head_type::version();
+            if (version < 3 || version >= EYEBALL_ALLOCATION_TABLE ||
+                head_type::size_type_size() != size_type(sizeof(size_type)) ||
+                (head_type::m_flags & head_type::FLAG_INVALID))
+            {
+                return false; // unknown
+            }
+
+            // check with the wide entries
+            typedef ENTRY_V4<T_SIZE> old_entry_type;
+            auto old_entry_size = size_type(sizeof(old_entry_type));
+            auto old_head_size = (version == 3) ? head_type::v3_head_size() : head_size();
+            auto b1 = head_type::m_boudary_1, b2 = head_type::m_boudary_2;
+            if (!(old_head_size <= b1 && b1 <= b2 && b2 <= total_size() &&
+                  (total_size() - b2) % old_entry_size == 0))
+            {
+                return false; // broken
+            }
+            auto num = size_type((total_size() - b2) / old_entry_size);
+            auto old_entries = reinterpret_cast<char *>(ptr_from_offset(b2));
+
+            if (version == 3) // the header has grown since version 4
+            {
+                // the data must be shifted by a multiple of the alignment
+                size_type align = 1;
+                old_entry_type old;
+                for (size_type i = 0; i < num; ++i)
+                {
+                    std::memcpy(&old, old_entries + i * old_entry_size, sizeof(old));
+                    auto entry = entry_type(old.m_data_size, old.m_offset, old.m_flags);
+                    if (align < entry.alignment())
+                        align = entry.alignment();
+                }
+                auto diff = align_up(size_type(head_size() - old_head_size), align);
+                if (diff > b2 - b1)
+                    return false; // no room
+
+                // shift the data area
+                std::memmove(ptr_from_offset(size_type(old_head_size + diff)),
+                             ptr_from_offset(old_head_size), b1 - old_head_size);
+                for (size_type i = 0; i < num; ++i)
+                {
+                    std::memcpy(&old, old_entries + i * old_entry_size, sizeof(old));
+                    old.m_offset += diff;
+                    std::memcpy(old_entries + i * old_entry_size, &old, sizeof(old));
+                }
+                head_type::m_boudary_1 += diff;
+                clear_roots();
+            }
+
+            // pack the entries toward the bottom, the lowest first
+            for (size_type i = num; i-- > 0; )
+            {
+                old_entry_type old;
+                std::memcpy(&old, old_entries + i * old_entry_size, sizeof(old));
+                auto offset = size_type(total_size() - (num - i) * entry_size());
+                *reinterpret_cast<entry_type *>(ptr_from_offset(offset)) =
+                    entry_type(old.m_data_size, old.m_offset, old.m_flags);
+            }
+            head_type::m_boudary_2 = size_type(total_size() - num * entry_size());
+            head_type::m_magic[3] = char(EYEBALL_ALLOCATION_TABLE);
+
+            if (!is_intact())
+            {
+                head_type::m_flags |= head_type::FLAG_INVALID; // refuse it from now on
+                return false; // broken
+            }
+            return true;
         }
 
-        // Attributes
-        bool is_valid() const
+        // Widen.
+        // copy a master of a narrower size type into this empty master.
+        // a source offset o becomes o + *pdiff, and the handles are kept.
+        // the handled blocks grow for the wider marks, so they may move.
+        // a master with slabs cannot be widened; a mark is forgotten.
+        template <typename T_SRC>
+        bool widen(const MASTER<T_SRC>& src, size_type *pdiff = NULL)
         {
-            if (!head_type::is_valid())
+            static_assert(sizeof(T_SRC) < sizeof(T_SIZE), "T_SIZE must be wider");
+            assert(is_valid() && empty());
+            assert(src.is_valid());
+            if (src.has_slabs() || widened_size(src) > total_size() ||
+                !detail::is_aligned_ptr(this, src.image_alignment()))
+            {
                 return false;
+            }
+            const HEAD<T_SRC>& src_head = src;
 
-            return ((head_size() <= total_size()) &&
-                    (total_size() == free_area_size() + used_area_size()) &&
-                    (used_area_size() == head_size() + data_area_size() + table_size()) &&
-                    ((table_size() % entry_size()) == 0));
+            // the data must be shifted by a multiple of the alignment
+            auto diff = align_up(size_type(head_size() - src.head_size()), src.max_alignment());
+            std::memcpy(ptr_from_offset(size_type(src.head_size() + diff)),
+                        src.get_data_area(), src.data_area_size());
+
+            // the table in one pass
+            auto num = src.num_entries();
+            auto src_entries = src.get_entries();
+            head_type::m_boudary_2 = size_type(total_size() - num * entry_size());
+            auto entries = get_entries();
+            for (size_type i = 0; i < num; ++i)
+            {
+                entries[i] = entry_type(src_entries[i].m_data_size,
+                                        size_type(src_entries[i].m_offset + diff),
+                                        src_entries[i].m_flags);
+            }
+            head_type::m_boudary_1 = size_type(src_head.m_boudary_1 + diff);
+            head_type::m_flags = (src_head.m_flags & ~uint32_t(head_type::SIZE_TYPE_SIZE_MASK)) |
+                                 uint32_t(size_type_size());
+            head_type::m_epoch = size_type(src_head.m_epoch + 1);
+            assert(is_valid());
+
+            // the handles, with the wider marks
+            if (src.handle_capacity())
+            {
+                if (!grow_handles(src.handle_capacity()))
+                    return false; // out of memory
+                auto src_table = src.get_handle_table();
+                auto table = get_handle_table();
+                table[1] = 0;
+                for (size_type h = table[0]; h > 0; --h)
+                {
+                    table[2 * h] = src_table[2 * h] ? size_type(src_table[2 * h] + diff) : 0;
+                    if (table[2 * h])
+                        continue;
+                    table[2 * h + 1] = table[1];
+                    table[1] = h;
+                }
+                free_(ptr_from_offset(size_type(src_head.m_handles + diff)));
+                for (size_t h = 1; h <= size_t(table[0]); ++h)
+                {
+                    if (!get_handle_table()[2 * h])
+                        continue;
+                    auto offset = get_handle_table()[2 * h];
+                    auto siz = get_entries()[find_entry_index(offset)].m_data_size - sizeof(T_SRC);
+                    if (!realloc_handle(size_type(h), size_type(siz)))
+                        return false; // out of memory
+                }
+            }
+
+            // the names
+            if (src.num_names())
+            {
+                if (!reserve_names(src.num_names()))
+                    return false; // out of memory
+                auto src_slots = src.get_name_slots();
+                for (size_t i = 1; i <= size_t(src_slots[0].m_handle); ++i)
+                {
+                    auto& old = src_slots[i];
+                    if (!old.m_handle)
+                        continue;
+                    NAME_SLOT slot = { old.m_handle, old.m_length, old.m_size, old.m_hash, old.m_flags };
+                    insert_name(slot);
+                }
+                free_(ptr_from_offset(size_type(src_head.m_names + diff)));
+            }
+
+            // the dirty map starts again, all dirty
+            if (src.is_tracking())
+            {
+                free_(ptr_from_offset(size_type(src_head.m_dirty + diff)));
+                if (!track_dirty(size_type(size_type(1) << src.get_dirty_map()[0])))
+                    return false; // out of memory
+                dirty_range(0, total_size());
+                dirty_table(total_size());
+            }
+
+            if (src_head.m_stats)
+            {
+                head_type::m_stats = size_type(src_head.m_stats + diff);
+                recount_stats();
+            }
+
+            if (pdiff)
+                *pdiff = diff;
+            assert(is_valid());
+            return true;
         }
-        bool empty() const
+
+        // the least total size to widen the source
+        template <typename T_SRC>
+        static size_t widened_size(const MASTER<T_SRC>& src)
         {
-            return (head_type::m_boudary_2 == head_type::m_total_size);
-        }
+            size_t align = src.max_alignment();
+            size_t size = sizeof(head_type) + align - 1 + src.data_area_size();
+            size_t entries = src.num_entries();
+            // a handled block may move to the end
+            auto capacity = src.handle_capacity();
+            for (size_t h = 1; h <= size_t(capacity); ++h)
+            {
+                auto offset = src.handle_offset(T_SRC(h));
+                if (!offset)
+                    continue;
+                auto& entry = src.get_entries()[src.find_entry_index(offset)];
+                size += entry.m_data_size + sizeof(size_type) + entry.alignment() - 1;
+                entries += 2;
+            }
+            if (capacity)
+            {
+                size += (size_t(capacity) * 2 + 2) * sizeof(size_type) + sizeof(size_type) - 1;
+                ++entries;
+            }
+            if (src.num_names())
+            {
+                size += (names_capacity(src.num_names()) + 1) * sizeof(NAME_SLOT) + alignof(NAME_SLOT) - 1;
+                ++entries;
+            }
+            if (src.is_tracking())
+            {
+                size_t pages = (size_t(src.total_size()) * 2 >> src.get_dirty_map()[0]) + 1;
+                size += 3 * sizeof(size_type) + (pages + 7) / 8 + sizeof(size_type) - 1;
+                ++entries;
+            }
+            return size + entries * sizeof(entry_type);
+        }
+
+        // index access
+        void *operator[](size_type index)
+        {
+            return reinterpret_cast<uint8_t *>(this)[index];
+        }
+        const void *operator[](size_type index) const
+        {
+            return reinterpret_cast<const uint8_t *>(this)[index];
+        }
+        size_type size() const
+        {
+            return head_type::m_total_size;
+        }
+
+        // Attributes
+        // NOTE: is_valid checks the header only, in constant time, so that it
+        //       can be asserted on every operation. is_intact walks the table
+        //       as well; check it on an image from outside.
+        bool is_valid() const
+        {
+            if (!head_type::is_valid())
+                return false;
+
+            return ((head_size() <= total_size()) &&
+                    (total_size() == free_area_size() + used_area_size()) &&
+                    (used_area_size() == head_size() + data_area_size() + table_size()) &&
+                    ((table_size() % entry_size()) == 0));
+        }
+        bool is_intact() const
+        {
+            return is_valid() && is_sorted_table();
+        }
+        // the offsets strictly decrease within the data area
+        bool is_sorted_table() const
+        {
+            auto entries = get_entries();
+            auto num = num_entries();
+            auto end = head_type::m_boudary_1;
+            for (size_type i = 0; i < num; ++i)
+            {
+                if (entries[i].m_offset >= end || entries[i].m_offset < head_size())
+                    return false;
+                end = entries[i].m_offset;
+            }
+            return true;
+        }
+        bool empty() const
+        {
+            return (head_type::m_boudary_2 == head_type::m_total_size);
+        }
         size_type head_size() const
         {
             return size_type(sizeof(head_type));
@@ -363,7 +1314,64 @@ namespace EAT
         }
         void modify_flags(uint32_t add_, uint32_t remove_)
         {
-            modify_flags(add_, remove_);
+            head_type::modify_flags(add_, remove_);
+        }
+
+        // the default alignment of malloc_
+        size_type alignment() const
+        {
+            return head_type::alignment();
+        }
+        bool set_alignment(size_type align)
+        {
+            if (!is_valid_alignment(align) || !detail::is_aligned_ptr(this, align))
+                return false;
+            modify_flags(uint32_t(entry_type::alignment_flags(align)), head_type::ALIGNMENT_MASK);
+            return true;
+        }
+        static bool is_valid_alignment(size_type align)
+        {
+            return (align > 0 && (align & (align - 1)) == 0 &&
+                    align <= EAT_MASTER_ALIGNMENT && align <= (size_type(1) << 15));
+        }
+        static size_type align_up(size_type offset, size_type align)
+        {
+            return size_type((offset + align - 1) & ~size_type(align - 1));
+        }
+        static size_t align_up_size(size_t offset, size_type align)
+        {
+            return (offset + align - 1) & ~size_t(align - 1);
+        }
+
+        // the alignment that the address of the image needs
+        size_type image_alignment() const
+        {
+            return std::max(alignment(), address_alignment());
+        }
+        // the strictest alignment of the blocks
+        size_type max_alignment() const
+        {
+            auto entries = get_entries();
+            size_type align = 1;
+            for (size_type i = 0; i < num_entries(); ++i)
+            {
+                if (align < entries[i].alignment())
+                    align = entries[i].alignment();
+            }
+            return align;
+        }
+        // the strictest alignment of the block addresses.
+        // the offset aligned blocks such as the slabs are left out.
+        size_type address_alignment() const
+        {
+            auto entries = get_entries();
+            size_type align = 1;
+            for (size_type i = 0; i < num_entries(); ++i)
+            {
+                if (!entries[i].is_offset_aligned() && align < entries[i].alignment())
+                    align = entries[i].alignment();
+            }
+            return align;
         }
 
         // entries
@@ -384,9 +1392,42 @@ namespace EAT
             return reinterpret_cast<const entry_type *>(p);
         }
 
+        // find the index of the entry of the offset by binary search.
+        // returns num_entries() if not found.
+        size_type find_entry_index(size_type offset, size_t *pprobes = NULL) const
+        {
+            auto entries = get_entries();
+            size_type lo = 0, hi = num_entries();
+            while (lo < hi)
+            {
+                if (pprobes)
+                    ++*pprobes;
+                auto mid = size_type(lo + (hi - lo) / 2);
+                auto mid_offset = entries[mid].m_offset;
+                if (mid_offset == offset) // found
+                    return mid;
+                if (mid_offset > offset) // descending order
+                    lo = size_type(mid + 1);
+                else
+                    hi = mid;
+            }
+            return num_entries(); // not found
+        }
+
         // fetch the entry
         entry_type *fetch_entry(void *ptr)
         {
+#ifndef EAT_NO_STATS
+            if (has_stats() && ptr)
+            {
+                size_t probes = 0;
+                auto index = find_entry_index(offset_from_ptr(ptr), &probes);
+                auto stats = get_stats();
+                ++stats->m_fetches;
+                stats->m_probes += probes;
+                return (index < num_entries()) ? &get_entries()[index] : NULL;
+            }
+#endif
             return const_cast<entry_type *>(const_cast<const self_type*>(this)->fetch_entry(ptr));
         }
         const entry_type *fetch_entry(void *ptr) const
@@ -396,60 +1437,80 @@ namespace EAT
             if (!ptr)
                 return NULL;
 
-            auto offset = offset_from_ptr(ptr);
             // find entry of same offset
-            auto entries = get_entries();
-            for (size_type i = 0; i < num_entries(); ++i)
-            {
-                if (entries[i].m_offset == offset) // found
-                {
-                    ret = &entries[i];
-                    break;
-                }
-            }
+            auto index = find_entry_index(offset_from_ptr(ptr));
+            if (index < num_entries()) // found
+                ret = &get_entries()[index];
+
             assert(is_valid());
             return ret;
         }
 
+        // the end offset of the space of the entry (up to the next block)
+        size_type entry_end(size_type index) const
+        {
+            if (index == 0)
+                return head_type::m_boudary_1;
+            return get_entries()[index - 1].m_offset;
+        }
+
+        // the first valid (or invalid) entry at or after the index,
+        // or num_entries() if none
+        size_type next_entry(size_type index, bool valid = true) const
+        {
+            auto i = detail::find_flag(get_entries(), index, num_entries(),
+                                       entry_type::FLAG_VALID, valid);
+            return (i == detail::NOT_FOUND) ? num_entries() : size_type(i);
+        }
+        // the last valid (or invalid) entry before the index,
+        // or num_entries() if none
+        size_type prev_entry(size_type index, bool valid = true) const
+        {
+            auto i = detail::rfind_flag(get_entries(), 0, index,
+                                        entry_type::FLAG_VALID, valid);
+            return (i == detail::NOT_FOUND) ? num_entries() : size_type(i);
+        }
+
         void free_entry(entry_type *entry)
         {
             assert(is_valid());
             if (!entry)
                 return;
 
+            auto entries = get_entries();
+            auto index = size_type(entry - entries);
+            dirty_entry(index);
+            if (entry->is_valid())
+                count_free(entry->m_data_size);
             entry->invalidate();
+            uncompacted(entry->m_offset);
 
-            auto entries = get_entries();
-            if (entry != entries)
+            // the neighbor holes are coalesced lazily by reuse_hole and compact
+            if (index != 0)
             {
                 assert(is_valid());
                 return;
             }
 
-            // top entry
-            auto num = num_entries();
-            size_type i, data_deletion = 0;
-            for (i = 0; i < num; ++i)
+            // top entry: free invalids
+            while (num_entries() > 0 && !get_entries()[0].is_valid())
             {
-                if (entries[i].is_valid())
-                    break;
-                data_deletion += entries[i].m_data_size;
+                remove_entry(0);
             }
 
-            // free invalids
-            if (i == num)
+            if (num_entries() == 0)
             {
                 clear();
             }
             else
             {
-                head_type::m_boudary_1 -= data_deletion;
-                head_type::m_boudary_2 += size_type(i * entry_size());
+                auto& top = get_entries()[0];
+                head_type::m_boudary_1 = size_type(top.m_offset + top.m_data_size);
+                uncompacted(head_type::m_boudary_1);
             }
 
             assert(is_valid());
         }
-
         // offsets and pointers
         size_type offset_from_ptr(const void *ptr) const
         {
@@ -481,27 +1542,142 @@ namespace EAT
 
         // allocate
         void *malloc_(size_type siz)
+        {
+            return aligned_malloc_(siz, alignment());
+        }
+
+        // an offset_only block is aligned in the image, wherever the image is
+        void *aligned_malloc_(size_type siz, size_type align, bool offset_only = false)
         {
             assert(is_valid());
-            if (siz <= 0)
+            if (siz <= 0 || !is_valid_alignment(align) ||
+                (!offset_only && !detail::is_aligned_ptr(this, align)))
+            {
                 return NULL;
+            }
 
             // size is non-zero
+            auto offset = align_up(head_type::m_boudary_1, align);
+            auto pad = size_type(offset - head_type::m_boudary_1);
             auto required = size_type(siz + entry_size());
-            if (required > free_area_size())
-                return NULL; // out of memory
+            if (offset < head_type::m_boudary_1 || required < siz ||
+                pad > free_area_size() || required > free_area_size() - pad)
+            {
+                void *ret = reuse_hole(siz, align, offset_only); // no room in the free area
+                count_alloc(ret, siz);
+                return ret;
+            }
 
             // OK, allocatable
-            auto offset = head_type::m_boudary_1;
             void *ret = reinterpret_cast<void *>(&reinterpret_cast<uint8_t *>(this)[offset]);
-            head_type::m_boudary_1 += siz;
+            allocated_at(offset);
+            head_type::m_boudary_1 = size_type(offset + siz);
             head_type::m_boudary_2 -= entry_size();
-            get_entries()[0] = entry_type(siz, offset);
+            get_entries()[0] = entry_type(siz, offset, entry_flags(align, offset_only));
+            dirty_entry(0);
+            dirty_range(offset, siz);
+            count_alloc(ret, siz);
 
             assert(is_valid());
             return ret;
         }
 
+        // allocate in the best-fit hole
+        void *reuse_hole(size_type siz, size_type align = 1, bool offset_only = false)
+        {
+            assert(is_valid());
+
+            // find the smallest hole that fits
+            auto entries = get_entries();
+            auto num = num_entries();
+            size_type index = num, best_last = num, best = 0;
+            for (size_type i = next_entry(0, false); i < num; i = next_entry(size_type(i + 1), false))
+            {
+                // a run of the adjacent holes is one hole
+                auto last = size_type(next_entry(i) - 1);
+                auto end = entry_end(i);
+                auto hole = entries[last].m_offset;
+                auto start = align_up(hole, align);
+                auto first = i;
+                i = last;
+                if (start < hole || start > end || siz > end - start)
+                    continue;
+                auto space = size_type(end - hole);
+                if (index == num || space < best)
+                {
+                    index = first;
+                    best_last = last;
+                    best = space;
+                }
+            }
+            if (index == num)
+                return NULL; // out of memory
+
+            // coalesce the run into its lowest entry
+            remove_entries(index, size_type(best_last - index));
+            entries = get_entries();
+
+            auto offset = align_up(entries[index].m_offset, align);
+            auto end = entry_end(index);
+            dirty_entry(index);
+            dirty_range(offset, siz);
+
+            // keep the front of the hole if it is worth an entry
+            auto front = size_type(offset - entries[index].m_offset);
+            if (front > entry_size() && free_area_size() >= entry_size())
+            {
+                get_entries()[index].m_data_size = front;
+                insert_entry(index);
+            }
+
+            // split the rest of the hole if it is worth an entry
+            auto rest = size_type(end - offset - siz);
+            if (rest > entry_size() && free_area_size() >= entry_size())
+            {
+                insert_entry(index);
+                get_entries()[index] = entry_type(rest, size_type(offset + siz), entry_type::FLAG_NONE);
+                ++index;
+            }
+            get_entries()[index] = entry_type(siz, offset, entry_flags(align, offset_only));
+            bump_epoch();
+
+            assert(is_valid());
+            return ptr_from_offset(offset);
+        }
+
+        static size_type entry_flags(size_type align, bool offset_only = false)
+        {
+            return size_type(entry_type::FLAG_VALID | entry_type::alignment_flags(align) |
+                             (offset_only ? entry_type::FLAG_OFFSET_ALIGNED : 0));
+        }
+
+        // open a new entry slot at the index
+        void insert_entry(size_type index)
+        {
+            assert(free_area_size() >= entry_size());
+            auto entries = get_entries();
+            std::memmove(entries - 1, entries, index * entry_size());
+            head_type::m_boudary_2 -= entry_size();
+            dirty_entry(index);
+        }
+
+        // close the entry slot at the index
+        void remove_entry(size_type index)
+        {
+            remove_entries(index, 1);
+        }
+        // close the count entry slots from the index
+        void remove_entries(size_type index, size_type count)
+        {
+            if (count == 0)
+                return;
+            assert(size_t(index) + count <= num_entries());
+            dirty_entry(size_type(index + count - 1));
+            auto entries = get_entries();
+            std::memmove(entries + count, entries, index * entry_size());
+            head_type::m_boudary_2 += size_type(count * entry_size());
+        }
+
         void *calloc_(size_type nelem, size_type siz)
         {
             assert(is_valid());
@@ -529,29 +1705,115 @@ namespace EAT
             }
 
             // find the entry
-            auto entry = fetch_entry(ptr);
-            assert(entry);
-            if (!entry)
+            auto index = find_entry_index(offset_from_ptr(ptr));
+            assert(index < num_entries());
+            if (index >= num_entries())
                 return NULL; // entry not found
 
             // entry was found
-            void *ret = malloc_(siz);
+            count_realloc();
+            auto old_size = get_entries()[index].m_data_size;
+            if (resize_in_place(index, siz))
+            {
+                count_resized(old_size, siz);
+                dirty_range(offset_from_ptr(ptr), siz);
+                assert(is_valid());
+                return ptr;
+            }
+
+            auto old_entry = get_entries()[index];
+            void *ret = aligned_malloc_(siz, old_entry.alignment(), old_entry.is_offset_aligned());
             if (!ret)
                 return NULL;
 
             // copy contents
-            if (siz <= entry->m_data_size)
+            if (siz <= old_size)
                 std::memcpy(ret, ptr, siz);
             else
-                std::memcpy(ret, ptr, entry->m_data_size);
+                std::memcpy(ret, ptr, old_size);
 
-            // free old one
-            free_entry(entry);
+            // free old one (malloc_ may have moved the entry)
+            free_entry(fetch_entry(ptr));
 
             assert(is_valid());
             return ret;
         }
 
+        // change the size of the block without moving it, if possible
+        bool resize_in_place(size_type index, size_type siz)
+        {
+            assert(is_valid());
+            dirty_entry(index);
+            auto entries = get_entries();
+            auto offset = entries[index].m_offset;
+            if (siz > entries[index].m_data_size)
+                uncompacted(offset); // the grown block may cross the compacted offset
+
+            if (index == 0) // top block
+            {
+                if (siz > head_type::m_boudary_2 - offset)
+                    return false; // no room
+                entries[0].m_data_size = siz;
+                head_type::m_boudary_1 = size_type(offset + siz);
+                uncompacted(head_type::m_boudary_1);
+                assert(is_valid());
+                return true;
+            }
+
+            auto end = entry_end(index);
+            auto& next = entries[index - 1];
+            if (siz <= end - offset) // fits in its own space
+            {
+                entries[index].m_data_size = siz;
+                auto new_end = size_type(offset + siz);
+                uncompacted(new_end);
+                if (!next.is_valid()) // the hole grows downward
+                {
+                    next.m_data_size = size_type(entry_end(size_type(index - 1)) - new_end);
+                    next.m_offset = new_end;
+                }
+                else if (size_type(end - new_end) > entry_size() &&
+                         free_area_size() >= entry_size())
+                {
+                    // give the rest back as a new hole
+                    insert_entry(index);
+                    get_entries()[index] = entry_type(size_type(end - new_end), new_end,
+                                                      entry_type::FLAG_NONE);
+                }
+                assert(is_valid());
+                return true;
+            }
+
+            if (next.is_valid())
+                return false; // no hole after it
+
+            // extend into the run of the holes after it
+            auto first = prev_entry(index);
+            first = (first < index) ? size_type(first + 1) : 0;
+            auto hole_end = entry_end(first);
+            if (siz > hole_end - offset)
+                return false; // hole too small
+
+            // coalesce the run into one hole
+            remove_entries(first, size_type(index - 1 - first));
+            index = size_type(first + 1);
+            entries = get_entries();
+
+            auto new_end = size_type(offset + siz);
+            entries[index].m_data_size = siz;
+            if (size_type(hole_end - new_end) > entry_size())
+            {
+                // shrink the hole
+                entries[index - 1].m_offset = new_end;
+                entries[index - 1].m_data_size = size_type(hole_end - new_end);
+            }
+            else
+                remove_entry(size_type(index - 1)); // eat the whole hole
+
+            assert(is_valid());
+            return true;
+        }
+
         // free
         void free_(void * ptr)
         {
@@ -564,81 +1826,439 @@ namespace EAT
             assert(is_valid());
         }
 
-        char *strdup_(const char *psz)
+        // allocate n blocks at once with one room check. out[i] is NULL for
+        // a zero size. returns false and allocates nothing if failed.
+        bool malloc_batch(const size_type *sizes, size_t n, void **out)
         {
             assert(is_valid());
-            // calculate size
-            auto len = size_type(strlen(psz));
-            auto siz = size_type((len + 1) * sizeof(char));
-            // allocate
-            auto ret = reinterpret_cast<char *>(malloc_(siz));
-            if (ret)
-                std::memcpy(ret, psz, siz);
-            assert(is_valid());
-            return ret;
-        }
+            auto align = alignment();
 
-        #ifdef _WIN32
-            wchar_t *wcsdup_(const wchar_t *psz)
+            // check the room once
+            size_t offset = head_type::m_boudary_1, count = 0, bytes = 0;
+            for (size_t i = 0; i < n; ++i)
             {
-                assert(is_valid());
-                // calculate size
-                auto len = size_type(wcslen(psz));
-                auto siz = size_type((len + 1) * sizeof(wchar_t));
-                // allocate
-                auto ret = reinterpret_cast<wchar_t *>(malloc_(siz));
-                if (ret)
-                    std::memcpy(ret, psz, siz);
-                assert(is_valid());
-                return ret;
+                if (sizes[i] <= 0)
+                    continue;
+                offset = align_up_size(offset, align) + sizes[i];
+                bytes += sizes[i];
+                ++count;
+            }
+            size_t table = count * entry_size();
+            if (table > head_type::m_boudary_2 || offset > head_type::m_boudary_2 - table)
+            {
+                // no room in the free area; use the holes one by one
+                for (size_t i = 0; i < n; ++i)
+                {
+                    out[i] = (sizes[i] > 0) ? malloc_(sizes[i]) : NULL;
+                    if (sizes[i] > 0 && !out[i])
+                    {
+                        // free them newest first without reordering out
+                        while (i-- > 0)
+                        {
+                            free_(out[i]);
+                            out[i] = NULL;
+                        }
+                        return false;
+                    }
+                }
+                return true;
             }
-        #endif
-
-        void compact()
-        {
-            assert(is_valid());
-            auto num = num_entries();
-            if (num <= 0)
-                return;
 
-            // there are some entries
+            // write the entries contiguously, the newest at the top
+            auto blocks = count;
+            allocated_at(head_type::m_boudary_1);
+            dirty_range(head_type::m_boudary_1, size_type(offset - head_type::m_boudary_1));
+            dirty_table(head_type::m_boudary_2);
+            head_type::m_boudary_2 -= size_type(table);
             auto entries = get_entries();
-            auto offset = head_size();
-            auto p = reinterpret_cast<char *>(get_data_area());
-
-            // do scan the data area in reverse order
-            auto ep = &entries[num]; // end of entries
-            for (long i = long(num - 1); i >= 0; --i)
+            auto flags = entry_flags(align);
+            offset = head_type::m_boudary_1;
+            for (size_t i = 0; i < n; ++i)
             {
-                if (!entries[i].is_valid())
+                if (sizes[i] <= 0)
+                {
+                    out[i] = NULL;
                     continue;
-
-                // shift to p
-                std::memmove(p, ptr_from_offset(entries[i].m_offset), entries[i].m_data_size);
-                // fix offset
-                entries[i].m_offset = offset;
-                // copy entry and move up
-                --ep;
-                *ep = entries[i];
-                // increase p and offset
-                p += entries[i].m_data_size;
-                offset += entries[i].m_data_size;
+                }
+                offset = align_up_size(offset, align);
+                entries[--count] = entry_type(sizes[i], size_type(offset), flags);
+                out[i] = ptr_from_offset(size_type(offset));
+                offset += sizes[i];
             }
-
-            // update boundarys
-            head_type::m_boudary_1 = offset;
-            head_type::m_boudary_2 = offset_from_ptr(ep);
+            head_type::m_boudary_1 = size_type(offset);
+            count_alloc(out, bytes, blocks);
 
             assert(is_valid());
+            return true;
         }
 
-        bool resize(size_type total)
+        // free n blocks at once with one pass over the table.
+        // NOTE: ptrs is sorted in place.
+        void free_batch(void **ptrs, size_t n)
         {
             assert(is_valid());
+            std::sort(ptrs, ptrs + n, std::greater<void *>());
+
+            // invalidate the entries; both are in descending order
+            auto entries = get_entries();
+            auto num = num_entries();
+            auto begin = reinterpret_cast<char *>(this) + head_size();
+            auto end = reinterpret_cast<char *>(this) + head_type::m_boudary_1;
+            size_type i = 0, lowest = head_type::m_boudary_1;
+            for (size_t j = 0; i < num && j < n; )
+            {
+                auto p = reinterpret_cast<char *>(ptrs[j]);
+                if (!(begin <= p && p < end))
+                {
+                    ++j;
+                    continue;
+                }
+                auto offset = offset_from_ptr(p);
+                if (entries[i].m_offset > offset)
+                {
+                    ++i;
+                }
+                else
+                {
+                    if (entries[i].m_offset == offset && entries[i].is_valid())
+                    {
+                        dirty_entry(i);
+                        count_free(entries[i].m_data_size);
+                        entries[i].invalidate();
+                        lowest = offset;
+                    }
+                    ++j;
+                }
+            }
+            if (lowest == head_type::m_boudary_1)
+                return; // nothing freed
+            uncompacted(lowest);
+
+            // coalesce the holes toward the bottom of the table
+            size_type k = num;
+            for (size_type m = num; m-- > 0; )
+            {
+                if (!entries[m].is_valid() && k < num && !entries[k].is_valid())
+                {
+                    // the lower hole covers it
+                    entries[k].m_data_size =
+                        size_type(entries[m].m_offset + entries[m].m_data_size - entries[k].m_offset);
+                    continue;
+                }
+                entries[--k] = entries[m];
+            }
+            if (k > 0)
+                dirty_table(size_type(head_type::m_boudary_2 + num * entry_size()));
+            head_type::m_boudary_2 += size_type(k * entry_size());
+
+            // reclaim the trailing space once
+            while (num_entries() > 0 && !get_entries()[0].is_valid())
+            {
+                head_type::m_boudary_2 += entry_size();
+            }
+            if (num_entries() == 0)
+            {
+                clear();
+            }
+            else
+            {
+                auto& top = get_entries()[0];
+                head_type::m_boudary_1 = size_type(top.m_offset + top.m_data_size);
+                uncompacted(head_type::m_boudary_1);
+            }
+
+            assert(is_valid());
+        }
+
+        // Mark and release.
+        // release drops every block allocated after the mark at once.
+        // NOTE: The marks are nested like a stack. release fails and keeps the
+        //       blocks if a block may have been allocated below the mark
+        //       since the mark, that is, if a hole was reused, the blocks
+        //       were compacted, a handle was allocated or a block was
+        //       allocated after freeing the blocks below the mark.
+        struct MARK
+        {
+            size_type m_offset;     // boundary_1 at the mark
+            size_type m_epoch;
+            size_type m_outer;      // the offset of the outer mark
+        };
+        MARK mark()
+        {
+            MARK ret = { head_type::m_boudary_1, head_type::m_epoch, head_type::m_mark };
+            head_type::m_mark = head_type::m_boudary_1;
+            return ret;
+        }
+        bool release(const MARK& mark)
+        {
+            assert(is_valid());
+            head_type::m_mark = mark.m_outer; // pop the mark anyway
+            if (mark.m_epoch != head_type::m_epoch)
+                return false; // cannot undo
+
+            // the entries at or above the mark are on the top of the table
+            auto entries = get_entries();
+            size_type lo = 0, hi = num_entries();
+            while (lo < hi)
+            {
+                auto mid = size_type((lo + hi) / 2);
+                if (entries[mid].m_offset >= mark.m_offset)
+                    lo = size_type(mid + 1);
+                else
+                    hi = mid;
+            }
+            head_type::m_boudary_2 += size_type(lo * entry_size());
+
+            // trim the holes on the top
+            while (num_entries() > 0 && !get_entries()[0].is_valid())
+            {
+                head_type::m_boudary_2 += entry_size();
+            }
+            if (num_entries() > 0)
+            {
+                auto& top = get_entries()[0];
+                head_type::m_boudary_1 = size_type(top.m_offset + top.m_data_size);
+            }
+            else
+            {
+                head_type::m_boudary_1 = head_size();
+            }
+            uncompacted(head_type::m_boudary_1);
+            recount_stats();
+
+            assert(is_valid());
+            return true;
+        }
+
+        // the operations that a release cannot undo
+        void bump_epoch()
+        {
+            ++head_type::m_epoch;
+        }
+        void allocated_at(size_type offset)
+        {
+            if (offset < head_type::m_mark)
+                bump_epoch();
+        }
+
+        char *strdup_(const char *psz)
+        {
+            assert(is_valid());
+            // calculate size
+            auto len = size_type(strlen(psz));
+            auto siz = size_type((len + 1) * sizeof(char));
+            // allocate
+            auto ret = reinterpret_cast<char *>(malloc_(siz));
+            if (ret)
+                std::memcpy(ret, psz, siz);
+            assert(is_valid());
+            return ret;
+        }
+
+        #ifdef _WIN32
+            wchar_t *wcsdup_(const wchar_t *psz)
+            {
+                assert(is_valid());
+                // calculate size
+                auto len = size_type(wcslen(psz));
+                auto siz = size_type((len + 1) * sizeof(wchar_t));
+                // allocate
+                auto ret = reinterpret_cast<wchar_t *>(malloc_(siz));
+                if (ret)
+                    std::memcpy(ret, psz, siz);
+                assert(is_valid());
+                return ret;
+            }
+        #endif
+
+        void compact()
+        {
+            assert(is_valid());
+            auto num = num_entries();
+            if (num <= 0)
+                return;
+            bump_epoch();
+
+            // there are some entries
+            auto entries = get_entries();
+            auto offset = head_size();
+            auto p = reinterpret_cast<char *>(get_data_area());
+
+            // do scan the data area in reverse order
+            auto ep = &entries[num]; // end of entries
+            for (auto i = prev_entry(num); i < num; i = prev_entry(i))
+            {
+
+                // keep the alignment
+                auto aligned = align_up(offset, entries[i].alignment());
+                p += aligned - offset;
+                offset = aligned;
+                // shift to p
+                auto old_offset = entries[i].m_offset;
+                if (old_offset != offset) // count before the stats block moves
+                    count_moved(entries[i].m_data_size);
+                std::memmove(p, ptr_from_offset(old_offset), entries[i].m_data_size);
+                // fix offset
+                entries[i].m_offset = offset;
+                relocated(old_offset, entries[i]);
+                if (old_offset != offset) // after the dirty map may have moved
+                    dirty_range(offset, entries[i].m_data_size);
+                // copy entry and move up
+                --ep;
+                *ep = entries[i];
+                // increase p and offset
+                p += entries[i].m_data_size;
+                offset += entries[i].m_data_size;
+            }
+
+            // update boundarys
+            head_type::m_boudary_1 = offset;
+            head_type::m_boudary_2 = offset_from_ptr(ep);
+            dirty_table(head_type::m_total_size);
+            head_type::m_compacted = offset;
+
+            assert(is_valid());
+        }
+
+        // compact incrementally by moving about byte_budget bytes at most.
+        // returns true if the compaction has been finished.
+        bool compact_step(size_t byte_budget)
+        {
+            assert(is_valid());
+            bump_epoch();
+
+            // resume from the compacted offset
+            auto cursor = compacted_offset();
+            auto num = num_entries();
+            size_type i = num; // the lowest entry at or above the cursor
+            {
+                auto entries = get_entries();
+                size_type lo = 0, hi = num;
+                while (lo < hi)
+                {
+                    auto mid = size_type(lo + (hi - lo) / 2);
+                    if (entries[mid].m_offset >= cursor)
+                    {
+                        i = mid;
+                        lo = size_type(mid + 1);
+                    }
+                    else
+                    {
+                        hi = mid;
+                    }
+                }
+            }
+
+            if (i < num)
+                dirty_entry(i);
+
+            size_t moved = 0;
+            while (i < num_entries())
+            {
+                if (moved >= byte_budget)
+                {
+                    // suspended
+                    head_type::m_compacted = cursor;
+                    assert(is_valid());
+                    return false;
+                }
+
+                auto entries = get_entries();
+                if (entries[i].is_valid()) // shift the block to the cursor
+                {
+                    moved += shift_block(entries[i], cursor);
+                    cursor = size_type(entries[i].m_offset + entries[i].m_data_size);
+                    if (i == 0)
+                        head_type::m_boudary_1 = cursor; // the top block
+                    i = size_type(i - 1);
+                    continue;
+                }
+
+                // a hole
+                auto first = prev_entry(i);
+                if (first >= i) // the top holes
+                {
+                    remove_entries(0, size_type(i + 1));
+                    head_type::m_boudary_1 = cursor;
+                    break;
+                }
+
+                if (size_type(first + 1) < i) // coalesce the run of the holes
+                {
+                    moved += size_t(first + 1) * entry_size();
+                    remove_entries(size_type(first + 1), size_type(i - first - 1));
+                    i = size_type(first + 1);
+                    entries = get_entries();
+                }
+
+                // move the next block under the hole and swap their entries
+                auto block = entries[i - 1];
+                auto end = entry_end(size_type(i - 1));
+                moved += shift_block(block, cursor);
+                cursor = size_type(block.m_offset + block.m_data_size);
+                if (cursor < end)
+                {
+                    entries[i - 1] = entries[i];
+                    entries[i - 1].m_offset = cursor;
+                    entries[i - 1].m_data_size = size_type(end - cursor);
+                    entries[i] = block;
+                }
+                else
+                {
+                    // the block could not move; no room is left for the hole
+                    entries[i - 1] = block;
+                    moved += size_t(i) * entry_size();
+                    remove_entry(i);
+                }
+                --i;
+            }
+
+            // done
+            head_type::m_compacted = head_type::m_boudary_1;
+            assert(is_valid());
+            return true;
+        }
+
+        // move the block of the entry down to the cursor.
+        // returns the number of the moved bytes.
+        size_type shift_block(entry_type& entry, size_type cursor)
+        {
+            auto offset = align_up(cursor, entry.alignment());
+            if (offset >= entry.m_offset)
+                return 0;
+
+            auto old_offset = entry.m_offset;
+            count_moved(entry.m_data_size); // before the stats block moves
+            std::memmove(ptr_from_offset(offset), ptr_from_offset(old_offset), entry.m_data_size);
+            entry.m_offset = offset;
+            relocated(old_offset, entry);
+            dirty_range(offset, entry.m_data_size); // after the dirty map may have moved
+            return entry.m_data_size;
+        }
+
+        // the data below the compacted offset has no gap
+        size_type compacted_offset() const
+        {
+            auto offset = head_type::m_compacted;
+            if (offset < head_size())
+                offset = head_size();
+            if (offset > head_type::m_boudary_1)
+                offset = head_type::m_boudary_1;
+            return offset;
+        }
+        void uncompacted(size_type offset)
+        {
+            if (head_type::m_compacted > offset)
+                head_type::m_compacted = offset;
+        }
+
+        bool resize(size_type total)
+        {
+            assert(is_valid());
+
+            if (head_type::m_total_size == total)
+                return true;
 
-            if (head_type::m_total_size == total)
-                return true;
-
             auto num = num_entries();
             auto entries = get_entries();
             auto p = reinterpret_cast<char *>(entries);
@@ -663,94 +2283,2101 @@ namespace EAT
 
             // fix total
             head_type::m_total_size = total;
+            dirty_table(total);
 
             assert(is_valid());
             return true;
         }
 
-        // callback: bool T_ENTRY_FN(entry_type&);
-        template <typename T_ENTRY_FN>
-        void foreach_entry(T_ENTRY_FN& fn)
+        //////////////////////////////////////////////////////////////////////
+        // handles
+        //
+        // A handle is a stable slot id in the handle table, a system block
+        // that holds the offset of each handled block. Each handled block
+        // keeps its handle in its last size_type, so that compact and merge
+        // can fix the table when the block moves. The table is:
+        //     [0]: capacity, [1]: first free slot,
+        //     [2 * h]: offset of handle h (zero if free),
+        //     [2 * h + 1]: next free slot of handle h (if free)
+
+        typedef size_type handle_type;
+
+        size_type handle_capacity() const
+        {
+            if (!head_type::m_handles)
+                return 0;
+            return get_handle_table()[0];
+        }
+        size_type *get_handle_table()
+        {
+            return reinterpret_cast<size_type *>(ptr_from_offset(head_type::m_handles));
+        }
+        const size_type *get_handle_table() const
+        {
+            return reinterpret_cast<const size_type *>(ptr_from_offset(head_type::m_handles));
+        }
+
+        handle_type alloc_handle(size_type siz)
+        {
+            return alloc_handle(siz, alignment());
+        }
+        handle_type alloc_handle(size_type siz, size_type align, bool offset_only = false)
         {
             assert(is_valid());
-            auto entries = get_entries();
-            for (size_type i = 0; i < num_entries(); ++i)
+            auto total = size_type(siz + sizeof(size_type));
+            if (siz <= 0 || total < siz)
+                return 0;
+            bump_epoch();
+
+            // get a free slot
+            if (!head_type::m_handles || !get_handle_table()[1])
             {
-                auto& entry = entries[i];
-                if (!entry.is_valid())
-                    continue;
-                if (!fn(entry))
-                    break;
+                auto cap = handle_capacity();
+                if (!grow_handles(size_type(cap ? cap * 2 : 8)) &&
+                    !grow_handles(size_type(cap + 1)))
+                {
+                    return 0; // out of memory
+                }
             }
+
+            void *ptr = aligned_malloc_(total, align, offset_only);
+            if (!ptr)
+                return 0; // out of memory
+
+            auto table = get_handle_table();
+            handle_type h = table[1];
+            table[1] = table[2 * h + 1];
+            table[2 * h] = offset_from_ptr(ptr);
+            table[2 * h + 1] = 0;
+            dirty_handle(h);
+            set_handle_mark(*fetch_entry(ptr), h);
+
             assert(is_valid());
+            return h;
         }
 
-        // callback: bool T_PTR_FN(void *);
-        template <typename T_PTR_FN>
-        void foreach_ptr(T_PTR_FN& fn)
+        size_type handle_offset(handle_type h) const
+        {
+            if (h <= 0 || h > handle_capacity())
+                return 0;
+            return get_handle_table()[2 * h];
+        }
+        void *deref(handle_type h)
+        {
+            auto offset = handle_offset(h);
+            return (offset ? ptr_from_offset(offset) : NULL);
+        }
+        const void *deref(handle_type h) const
+        {
+            auto offset = handle_offset(h);
+            return (offset ? ptr_from_offset(offset) : NULL);
+        }
+        size_type handle_size(handle_type h) const
+        {
+            auto offset = handle_offset(h);
+            if (!offset)
+                return 0;
+            return size_type(get_entries()[find_entry_index(offset)].m_data_size - sizeof(size_type));
+        }
+
+        bool realloc_handle(handle_type h, size_type siz)
         {
             assert(is_valid());
-            auto entries = get_entries();
-            for (size_type i = 0; i < num_entries(); ++i)
-            {
-                auto& entry = entries[i];
-                if (!entry.is_valid())
-                    continue;
-                void *ptr = ptr_from_offset(entry.m_offset);
-                if (!fn(ptr))
-                    break;
-            }
+            auto total = size_type(siz + sizeof(size_type));
+            if (siz <= 0 || total < siz)
+                return false;
+
+            void *ptr = deref(h);
+            if (!ptr)
+                return false;
+
+            ptr = realloc_(ptr, total);
+            if (!ptr)
+                return false; // out of memory
+
+            get_handle_table()[2 * h] = offset_from_ptr(ptr);
+            dirty_handle(h);
+            set_handle_mark(*fetch_entry(ptr), h);
+
             assert(is_valid());
+            return true;
         }
-    }; // EAT::MASTER<T_SIZE>
 
-    //////////////////////////////////////////////////////////////////////////////
-    // EAT::create_master<T_SIZE>(total_size)
-    // EAT::resize_master<T_SIZE>(old_master, new_total_size)
-    // EAT::master_from_image<T_SIZE>(image_ptr, image_size = 0)
-    // EAT::destroy_master
+        void free_handle(handle_type h)
+        {
+            assert(is_valid());
+            void *ptr = deref(h);
+            if (!ptr)
+                return;
 
-    template <typename T_SIZE>
-    inline MASTER<T_SIZE> *create_master(size_t total_size)
-    {
-        auto master = reinterpret_cast<MASTER<T_SIZE> *>(std::malloc(total_size));
-        if (!master)
-            return NULL;
-        master->init(total_size);
-        return master;
-    }
+            free_(ptr);
 
-    inline void destroy_master(void *master)
-    {
-        std::free(master);
-    }
+            auto table = get_handle_table();
+            table[2 * h] = 0;
+            table[2 * h + 1] = table[1];
+            table[1] = h;
+            dirty_handle(h);
+            assert(is_valid());
+        }
 
-    template <typename T_SIZE>
-    inline MASTER<T_SIZE> *resize_master(MASTER<T_SIZE> *old_master, size_t new_total_size)
+        bool grow_handles(size_type capacity)
+        {
+            auto old_capacity = handle_capacity();
+            if (capacity <= old_capacity)
+                return true;
+            bump_epoch();
+
+            size_t bytes = (size_t(capacity) * 2 + 2) * sizeof(size_type);
+            if (bytes != size_type(bytes))
+                return false; // too large
+
+            void *ptr;
+            auto before = stats_before();
+            if (head_type::m_handles)
+                ptr = realloc_(ptr_from_offset(head_type::m_handles), size_type(bytes));
+            else
+                ptr = aligned_malloc_(size_type(bytes), size_type(sizeof(size_type)));
+            count_system(before);
+            if (!ptr)
+                return false; // out of memory
+
+            head_type::m_handles = offset_from_ptr(ptr);
+            auto table = get_handle_table();
+            if (!old_capacity)
+                table[1] = 0;
+            table[0] = capacity;
+            for (size_type h = capacity; h > old_capacity; --h)
+            {
+                table[2 * h] = 0;
+                table[2 * h + 1] = table[1];
+                table[1] = h;
+            }
+            return true;
+        }
+
+        handle_type get_handle_mark(const entry_type& entry) const
+        {
+            handle_type h = 0;
+            if (entry.m_data_size >= sizeof(size_type))
+            {
+                auto offset = size_type(entry.m_offset + entry.m_data_size - sizeof(size_type));
+                std::memcpy(&h, ptr_from_offset(offset), sizeof(h));
+            }
+            return h;
+        }
+        void set_handle_mark(const entry_type& entry, handle_type h)
+        {
+            assert(entry.m_data_size >= sizeof(size_type));
+            auto offset = size_type(entry.m_offset + entry.m_data_size - sizeof(size_type));
+            std::memcpy(ptr_from_offset(offset), &h, sizeof(h));
+        }
+
+        // fix the references to the block that moved from old_offset
+        void relocated(size_type old_offset, const entry_type& entry)
+        {
+            if (head_type::m_handles == old_offset)
+            {
+                head_type::m_handles = entry.m_offset;
+                return;
+            }
+            if (head_type::m_dirty == old_offset)
+            {
+                head_type::m_dirty = entry.m_offset;
+                return;
+            }
+            if (head_type::m_stats == old_offset)
+            {
+                head_type::m_stats = entry.m_offset;
+                return;
+            }
+            if (head_type::m_names == old_offset)
+            {
+                head_type::m_names = entry.m_offset;
+                return;
+            }
+            if (head_type::m_slabs == old_offset)
+            {
+                head_type::m_slabs = entry.m_offset;
+                return;
+            }
+
+            auto h = get_handle_mark(entry);
+            if (h > 0 && h <= handle_capacity() && get_handle_table()[2 * h] == old_offset)
+            {
+                get_handle_table()[2 * h] = entry.m_offset;
+                dirty_handle(h);
+            }
+        }
+
+        // take over the handles of the merged source.
+        // the source handle h becomes handle_base + h.
+        void merge_handles(const MASTER<T_SIZE>& src, size_type diff, size_type handle_base)
+        {
+            if (!src.handle_capacity())
+                return;
+            bump_epoch();
+
+            auto src_table_offset = size_type(src.head_type::m_handles + diff);
+            if (!head_type::m_handles) // adopt the source table
+            {
+                head_type::m_handles = src_table_offset; // in the merged data
+                auto table = get_handle_table();
+                for (size_t h = 1; h <= size_t(table[0]); ++h)
+                {
+                    if (table[2 * h])
+                        table[2 * h] += diff;
+                }
+                return;
+            }
+
+            // append the source slots
+            auto src_table = reinterpret_cast<const size_type *>(ptr_from_offset(src_table_offset));
+            auto table = get_handle_table();
+            for (size_t h = 1; h <= size_t(src_table[0]); ++h)
+            {
+                if (!src_table[2 * h])
+                    continue;
+                auto offset = size_type(src_table[2 * h] + diff);
+                table[2 * (handle_base + h)] = offset;
+                set_handle_mark(get_entries()[find_entry_index(offset)], size_type(handle_base + h));
+            }
+
+            // rebuild the free list
+            table[1] = 0;
+            for (size_type h = table[0]; h > 0; --h)
+            {
+                if (table[2 * h])
+                    continue;
+                table[2 * h + 1] = table[1];
+                table[1] = h;
+            }
+            dirty_range(head_type::m_handles, size_type((size_t(table[0]) * 2 + 2) * sizeof(size_type)));
+
+            // the copy of the source table is no longer needed
+            auto before = stats_before();
+            free_(ptr_from_offset(src_table_offset));
+            count_system(before);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // named objects
+        //
+        // The name directory is a system block, a hash table of the names by
+        // linear probing. A named object is a handled block that keeps its
+        // name after its data, so compact and merge keep the objects by their
+        // handles. The directory is:
+        //     [0]: the capacity in m_handle, the number of names in m_length,
+        //     followed by the slots; m_handle is zero in an empty slot.
+        // Use remove_named, not free_handle, and do not realloc_handle a
+        // named object. merge keeps the object of the destination if the
+        // name is in both.
+        // An interned string is a named object of no data in the same
+        // directory, with NAME_INTERNED in its flags; it is apart from the
+        // names of the objects.
+
+        struct NAME_SLOT
+        {
+            handle_type m_handle;
+            size_type   m_length;       // the length of the name
+            size_type   m_size;         // the size of the data
+            uint32_t    m_hash;
+            uint32_t    m_flags;        // the attributes of the object
+        };
+        static const uint32_t NAME_INTERNED = 0x80000000; // reserved flag
+
+        bool has_names() const
+        {
+            return head_type::m_names != 0;
+        }
+        NAME_SLOT *get_name_slots()
+        {
+            return reinterpret_cast<NAME_SLOT *>(ptr_from_offset(head_type::m_names));
+        }
+        const NAME_SLOT *get_name_slots() const
+        {
+            return reinterpret_cast<const NAME_SLOT *>(ptr_from_offset(head_type::m_names));
+        }
+        // the number of the names and the interned strings
+        size_type num_names() const
+        {
+            return has_names() ? get_name_slots()[0].m_length : 0;
+        }
+
+        // allocate a named object. returns zero if the name exists or if
+        // out of memory. the flags must not have NAME_INTERNED.
+        handle_type create_named(const char *name, size_type siz, uint32_t flags = 0)
+        {
+            assert(is_valid());
+            assert(!(flags & NAME_INTERNED));
+            size_t len = std::strlen(name);
+            auto hash = hash_name(name, len);
+            if (find_name_slot(name, len, hash, 0))
+                return 0;
+            return add_name(name, len, hash, siz, flags & ~NAME_INTERNED);
+        }
+
+        // the handle of the named object, or zero
+        handle_type find_named(const char *name, size_type *psize = NULL, uint32_t *pflags = NULL) const
+        {
+            size_t len = std::strlen(name);
+            auto slot = find_name_slot(name, len, hash_name(name, len), 0);
+            if (!slot)
+                return 0;
+            if (psize)
+                *psize = slot->m_size;
+            if (pflags)
+                *pflags = slot->m_flags;
+            return slot->m_handle;
+        }
+
+        bool set_named_flags(const char *name, uint32_t flags)
+        {
+            size_t len = std::strlen(name);
+            auto slot = const_cast<NAME_SLOT *>(find_name_slot(name, len, hash_name(name, len), 0));
+            if (!slot)
+                return false;
+            slot->m_flags = flags & ~NAME_INTERNED;
+            dirty_range(offset_from_ptr(slot), sizeof(NAME_SLOT));
+            return true;
+        }
+
+        // free the named object
+        bool remove_named(const char *name)
+        {
+            assert(is_valid());
+            size_t len = std::strlen(name);
+            auto found = find_name_slot(name, len, hash_name(name, len), 0);
+            if (!found)
+                return false;
+
+            // close the slot by shifting the following slots back
+            auto slots = get_name_slots();
+            auto h = found->m_handle;
+            size_type mask = size_type(slots[0].m_handle - 1);
+            auto i = size_type(found - slots - 1), j = i;
+            for (;;)
+            {
+                j = size_type((j + 1) & mask);
+                if (!slots[j + 1].m_handle)
+                    break;
+                auto k = size_type(slots[j + 1].m_hash & mask);
+                if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+                    continue; // it stays in its chain
+                slots[i + 1] = slots[j + 1];
+                dirty_range(offset_from_ptr(&slots[i + 1]), sizeof(NAME_SLOT));
+                i = j;
+            }
+            slots[i + 1].m_handle = 0;
+            --slots[0].m_length;
+            dirty_range(offset_from_ptr(&slots[i + 1]), sizeof(NAME_SLOT));
+            dirty_range(head_type::m_names, sizeof(NAME_SLOT));
+
+            free_handle(h);
+            assert(is_valid());
+            return true;
+        }
+
+        // callback: bool T_NAME_FN(const char *name, const NAME_SLOT& slot);
+        // the interned strings are skipped.
+        template <typename T_NAME_FN>
+        void foreach_named(T_NAME_FN& fn) const
+        {
+            if (!has_names())
+                return;
+            auto slots = get_name_slots();
+            for (size_t i = 1; i <= size_t(slots[0].m_handle); ++i)
+            {
+                if (!slots[i].m_handle || (slots[i].m_flags & NAME_INTERNED))
+                    continue;
+                if (!fn(name_of(slots[i]), slots[i]))
+                    break;
+            }
+        }
+
+        // the copy of the string in the image. the same string gives the
+        // same copy, so the interned strings compare by their offsets.
+        // returns NULL if out of memory. do not free_ or modify it.
+        const char *intern_(const char *str)
+        {
+            assert(is_valid());
+            size_t len = std::strlen(str);
+            auto hash = hash_name(str, len);
+            auto slot = find_name_slot(str, len, hash, NAME_INTERNED);
+            if (slot)
+                return name_of(*slot);
+            auto h = add_name(str, len, hash, 0, NAME_INTERNED);
+            return h ? reinterpret_cast<const char *>(deref(h)) : NULL;
+        }
+        // the interned copy of the string, or NULL
+        const char *find_interned(const char *str) const
+        {
+            size_t len = std::strlen(str);
+            auto slot = find_name_slot(str, len, hash_name(str, len), NAME_INTERNED);
+            return slot ? name_of(*slot) : NULL;
+        }
+
+        static uint32_t hash_name(const char *name, size_t len)
+        {
+            uint32_t hash = 2166136261U; // FNV-1a
+            for (size_t i = 0; i < len; ++i)
+            {
+                hash ^= uint8_t(name[i]);
+                hash *= 16777619U;
+            }
+            return hash;
+        }
+        const char *name_of(const NAME_SLOT& slot) const
+        {
+            auto offset = handle_offset(slot.m_handle);
+            return reinterpret_cast<const char *>(ptr_from_offset(size_type(offset + slot.m_size)));
+        }
+        // kind is NAME_INTERNED or zero
+        const NAME_SLOT *find_name_slot(const char *name, size_t len, uint32_t hash, uint32_t kind) const
+        {
+            if (!has_names())
+                return NULL;
+            auto slots = get_name_slots();
+            size_type mask = size_type(slots[0].m_handle - 1);
+            for (auto i = size_type(hash & mask); slots[i + 1].m_handle; i = size_type((i + 1) & mask))
+            {
+                auto& slot = slots[i + 1];
+                if (slot.m_hash == hash && slot.m_length == len &&
+                    (slot.m_flags & NAME_INTERNED) == kind &&
+                    std::memcmp(name_of(slot), name, len) == 0)
+                {
+                    return &slot;
+                }
+            }
+            return NULL;
+        }
+
+        // the capacity for count names, up to three quarters full
+        static size_t names_capacity(size_t count)
+        {
+            size_t capacity = 8;
+            while (capacity * 3 < count * 4)
+                capacity *= 2;
+            return capacity;
+        }
+        // the free area to make a directory for count names at most
+        size_t names_room(size_t count) const
+        {
+            return (names_capacity(count) + 1) * sizeof(NAME_SLOT) + alignof(NAME_SLOT) - 1 + entry_size();
+        }
+
+        // grow the directory for count names
+        bool reserve_names(size_t count)
+        {
+            auto capacity = names_capacity(count);
+            if (has_names() && capacity <= get_name_slots()[0].m_handle)
+                return true;
+            size_t bytes = (capacity + 1) * sizeof(NAME_SLOT);
+            if (bytes != size_type(bytes))
+                return false; // too large
+            bump_epoch();
+
+            auto before = stats_before();
+            void *ptr = aligned_malloc_(size_type(bytes), size_type(alignof(NAME_SLOT)));
+            count_system(before);
+            if (!ptr)
+                return false; // out of memory
+            std::memset(ptr, 0, bytes);
+            auto old_offset = head_type::m_names;
+            head_type::m_names = offset_from_ptr(ptr);
+            get_name_slots()[0].m_handle = size_type(capacity);
+
+            // rehash
+            if (old_offset)
+            {
+                auto old_slots = reinterpret_cast<NAME_SLOT *>(ptr_from_offset(old_offset));
+                for (size_t i = 1; i <= size_t(old_slots[0].m_handle); ++i)
+                {
+                    if (old_slots[i].m_handle)
+                        insert_name(old_slots[i]);
+                }
+                before = stats_before();
+                free_(old_slots);
+                count_system(before);
+            }
+            return true;
+        }
+        // allocate the object of the new name
+        handle_type add_name(const char *name, size_t len, uint32_t hash, size_type siz, uint32_t flags)
+        {
+            size_t total = size_t(siz) + len + 1;
+            if (total != size_type(total))
+                return 0; // too large
+            if (!reserve_names(size_t(num_names()) + 1))
+                return 0; // out of memory
+
+            auto h = alloc_handle(size_type(total));
+            if (!h)
+                return 0; // out of memory
+            std::memcpy(reinterpret_cast<char *>(deref(h)) + siz, name, len + 1);
+            NAME_SLOT slot = { h, size_type(len), siz, hash, flags };
+            insert_name(slot);
+            return h;
+        }
+        // the name must not be in the directory, and there must be room
+        void insert_name(const NAME_SLOT& slot)
+        {
+            auto slots = get_name_slots();
+            size_type mask = size_type(slots[0].m_handle - 1);
+            auto i = size_type(slot.m_hash & mask);
+            while (slots[i + 1].m_handle)
+                i = size_type((i + 1) & mask);
+            slots[i + 1] = slot;
+            ++slots[0].m_length;
+            dirty_range(offset_from_ptr(&slots[i + 1]), sizeof(NAME_SLOT));
+            dirty_range(head_type::m_names, sizeof(NAME_SLOT));
+        }
+
+        // take over the names of the merged source after its handles.
+        // an interned string of both is unified to the copy of the
+        // destination; the source copy is kept for the merged references.
+        void merge_names(const MASTER<T_SIZE>& src, size_type diff, size_type handle_base)
+        {
+            if (!src.num_names())
+                return;
+            bool reserved = reserve_names(size_t(num_names()) + src.num_names());
+            assert(reserved); // merge_room has made room
+            (void)reserved;
+
+            // the copy of the source directory
+            auto src_slots = reinterpret_cast<const NAME_SLOT *>(
+                ptr_from_offset(size_type(src.head_type::m_names + diff)));
+            for (size_t i = 1; i <= size_t(src_slots[0].m_handle); ++i)
+            {
+                if (!src_slots[i].m_handle)
+                    continue;
+                NAME_SLOT slot = src_slots[i];
+                slot.m_handle = size_type(slot.m_handle + handle_base);
+                if (!find_name_slot(name_of(slot), slot.m_length, slot.m_hash,
+                                    slot.m_flags & NAME_INTERNED))
+                {
+                    insert_name(slot);
+                }
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // slabs
+        //
+        // A slab is a handled block of slab_size() bytes at an offset aligned
+        // to slab_size(). It holds the objects of a size class, with a bitmap
+        // of the used ones, so one entry covers many tiny objects and
+        // slab_free_ finds the slab of an object by masking its offset. The
+        // slab directory is a system block:
+        //     [0]: the slab size,
+        //     followed by the handle of the first slab with free objects of
+        //     each size class.
+        // Such slabs are linked by the handles in their headers, so compact
+        // and merge keep them. An empty slab is freed.
+        // Use slab_free_ only for the objects of slab_malloc_.
+
+        struct SLAB
+        {
+            size_type   m_class;        // the index of the size class
+            size_type   m_free;         // the number of the free objects
+            handle_type m_next;         // the next slab with free objects
+            handle_type m_prev;
+        };
+        enum
+        {
+            SLAB_NUM_CLASSES = 8,
+            SLAB_MAX_SIZE = 128,
+            SLAB_ALIGN = 8
+        };
+        static size_type slab_class_size(size_type c)
+        {
+            static const uint8_t s_sizes[SLAB_NUM_CLASSES] = { 8, 16, 24, 32, 48, 64, 96, 128 };
+            return s_sizes[c];
+        }
+
+        bool has_slabs() const
+        {
+            return head_type::m_slabs != 0;
+        }
+        size_type *get_slab_directory()
+        {
+            return reinterpret_cast<size_type *>(ptr_from_offset(head_type::m_slabs));
+        }
+        const size_type *get_slab_directory() const
+        {
+            return reinterpret_cast<const size_type *>(ptr_from_offset(head_type::m_slabs));
+        }
+        size_type slab_size() const
+        {
+            return has_slabs() ? get_slab_directory()[0] : 0;
+        }
+
+        // start the slabs. slab_size must be a power of two from 256.
+        bool enable_slabs(size_type slab_size = (sizeof(size_type) > 2) ? 4096 : 1024)
+        {
+            assert(is_valid());
+            if (has_slabs())
+                return this->slab_size() == slab_size;
+            if (slab_size < 256 || (slab_size & (slab_size - 1)) || !is_valid_alignment(slab_size))
+                return false;
+            bump_epoch();
+
+            size_t bytes = (1 + SLAB_NUM_CLASSES) * sizeof(size_type);
+            auto before = stats_before();
+            void *ptr = aligned_malloc_(size_type(bytes), size_type(sizeof(size_type)));
+            count_system(before);
+            if (!ptr)
+                return false; // out of memory
+            std::memset(ptr, 0, bytes);
+            head_type::m_slabs = offset_from_ptr(ptr);
+            get_slab_directory()[0] = slab_size;
+            return true;
+        }
+
+        // allocate a tiny object up to SLAB_MAX_SIZE bytes.
+        // returns NULL if it is larger, or if out of memory.
+        void *slab_malloc_(size_type siz)
+        {
+            assert(is_valid());
+            if (!has_slabs() || siz <= 0 || siz > SLAB_MAX_SIZE)
+                return NULL;
+            size_type c = 0;
+            while (slab_class_size(c) < siz)
+                ++c;
+
+            auto h = get_slab_directory()[1 + c];
+            if (!h)
+            {
+                // a new slab
+                h = alloc_handle(size_type(slab_size() - sizeof(size_type)), slab_size(), true);
+                if (!h)
+                    return NULL; // out of memory
+                auto slab = reinterpret_cast<SLAB *>(deref(h));
+                slab->m_class = c;
+                slab->m_free = slab_capacity(c);
+                slab->m_next = slab->m_prev = 0;
+                std::memset(slab + 1, 0, slab_objects(c) - sizeof(SLAB));
+                link_slab(h);
+            }
+
+            // find a free object
+            auto slab = reinterpret_cast<SLAB *>(deref(h));
+            auto bits = reinterpret_cast<uint8_t *>(slab + 1);
+            size_type index = 0;
+            while (bits[index / 8] == 0xFF)
+                index = size_type(index + 8);
+            while (bits[index / 8] & (1 << (index % 8)))
+                ++index;
+            assert(index < slab_capacity(c));
+            bits[index / 8] |= uint8_t(1 << (index % 8));
+            if (--slab->m_free == 0)
+                unlink_slab(h); // full
+
+            auto base = handle_offset(h);
+            dirty_range(base, slab_objects(c));
+            return ptr_from_offset(size_type(base + slab_objects(c) + index * slab_class_size(c)));
+        }
+
+        void slab_free_(void *ptr)
+        {
+            assert(is_valid());
+            if (!ptr)
+                return;
+            auto offset = offset_from_ptr(ptr);
+            auto base = size_type(offset & ~size_type(slab_size() - 1));
+            auto slab = reinterpret_cast<SLAB *>(ptr_from_offset(base));
+            auto c = slab->m_class;
+            auto index = size_type((offset - base - slab_objects(c)) / slab_class_size(c));
+            auto bits = reinterpret_cast<uint8_t *>(slab + 1);
+            assert(c < SLAB_NUM_CLASSES && (bits[index / 8] & (1 << (index % 8))));
+            bits[index / 8] &= uint8_t(~(1 << (index % 8)));
+            dirty_range(base, slab_objects(c));
+
+            auto h = slab_of(ptr);
+            if (slab->m_free++ == 0)
+                link_slab(h); // no longer full
+            if (slab->m_free == slab_capacity(c))
+            {
+                unlink_slab(h); // empty
+                free_handle(h);
+            }
+        }
+
+        // the handle of the slab of the object. an object o of the slab h
+        // is at deref(h) + (o - deref(h)) after compact.
+        handle_type slab_of(const void *ptr) const
+        {
+            auto base = size_type(offset_from_ptr(ptr) & ~size_type(slab_size() - 1));
+            handle_type h;
+            std::memcpy(&h, ptr_from_offset(size_type(base + slab_size() - sizeof(size_type))), sizeof(h));
+            return h;
+        }
+
+        // the offset of the objects in the slab of the class
+        size_type slab_objects(size_type c) const
+        {
+            auto count = slab_capacity(c);
+            return size_type(align_up_size(sizeof(SLAB) + (count + 7) / 8, SLAB_ALIGN));
+        }
+        // the number of the objects in the slab of the class
+        size_type slab_capacity(size_type c) const
+        {
+            size_t usable = slab_size() - sizeof(size_type); // but the handle mark
+            size_t obj = slab_class_size(c);
+            size_t count = (usable - sizeof(SLAB)) * 8 / (obj * 8 + 1);
+            while (align_up_size(sizeof(SLAB) + (count + 7) / 8, SLAB_ALIGN) + count * obj > usable)
+                --count;
+            return size_type(count);
+        }
+
+        // push the slab to the list of its class
+        void link_slab(handle_type h)
+        {
+            auto slab = reinterpret_cast<SLAB *>(deref(h));
+            auto dir = get_slab_directory();
+            auto head = dir[1 + slab->m_class];
+            slab->m_prev = 0;
+            slab->m_next = head;
+            if (head)
+            {
+                reinterpret_cast<SLAB *>(deref(head))->m_prev = h;
+                dirty_range(handle_offset(head), sizeof(SLAB));
+            }
+            dir[1 + slab->m_class] = h;
+            dirty_range(handle_offset(h), sizeof(SLAB));
+            dirty_range(head_type::m_slabs, (1 + SLAB_NUM_CLASSES) * sizeof(size_type));
+        }
+        void unlink_slab(handle_type h)
+        {
+            auto slab = reinterpret_cast<SLAB *>(deref(h));
+            if (slab->m_prev)
+            {
+                reinterpret_cast<SLAB *>(deref(slab->m_prev))->m_next = slab->m_next;
+                dirty_range(handle_offset(slab->m_prev), sizeof(SLAB));
+            }
+            else
+            {
+                get_slab_directory()[1 + slab->m_class] = slab->m_next;
+                dirty_range(head_type::m_slabs, (1 + SLAB_NUM_CLASSES) * sizeof(size_type));
+            }
+            if (slab->m_next)
+            {
+                reinterpret_cast<SLAB *>(deref(slab->m_next))->m_prev = slab->m_prev;
+                dirty_range(handle_offset(slab->m_next), sizeof(SLAB));
+            }
+            slab->m_next = slab->m_prev = 0;
+            dirty_range(handle_offset(h), sizeof(SLAB));
+        }
+
+        bool slabs_mergeable(const MASTER<T_SIZE>& src) const
+        {
+            return !has_slabs() || !src.has_slabs() || slab_size() == src.slab_size();
+        }
+        size_t slabs_room() const
+        {
+            return (1 + SLAB_NUM_CLASSES) * sizeof(size_type) + sizeof(size_type) - 1 + entry_size();
+        }
+
+        // take over the slabs of the merged source after its handles
+        void merge_slabs(const MASTER<T_SIZE>& src, size_type diff, size_type handle_base)
+        {
+            if (!src.has_slabs())
+                return;
+            auto src_dir = reinterpret_cast<const size_type *>(
+                ptr_from_offset(size_type(src.head_type::m_slabs + diff)));
+            bool enabled = enable_slabs(src_dir[0]);
+            assert(enabled); // merge_room has made room
+            (void)enabled;
+
+            for (size_type c = 0; c < SLAB_NUM_CLASSES; ++c)
+            {
+                for (handle_type h = src_dir[1 + c]; h; )
+                {
+                    h = size_type(h + handle_base);
+                    auto slab = reinterpret_cast<SLAB *>(deref(h));
+                    auto next = slab->m_next;
+                    link_slab(h);
+                    h = next;
+                }
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // dirty tracking
+        //
+        // The dirty map is a system block that records what has changed
+        // since the last delta: the pages of the data area, and the end of
+        // the changed part of the table. Every change of the table moves the
+        // entries from boundary_2 only, so one offset is enough. The map is:
+        //     [0]: log2 of the page size, [1]: number of pages,
+        //     [2]: end offset of the changed entries (zero if none),
+        //     followed by one bit per page.
+        // A page out of the map (after growing the image) is always dirty.
+        // The library marks what it writes; touch the blocks you write.
+
+        bool is_tracking() const
+        {
+            return head_type::m_dirty != 0;
+        }
+        size_type *get_dirty_map()
+        {
+            return reinterpret_cast<size_type *>(ptr_from_offset(head_type::m_dirty));
+        }
+        const size_type *get_dirty_map() const
+        {
+            return reinterpret_cast<const size_type *>(ptr_from_offset(head_type::m_dirty));
+        }
+
+        // start tracking, or extend the map to the current total size.
+        // page_size must be a power of two.
+        bool track_dirty(size_type page_size = 4096)
+        {
+            assert(is_valid());
+            if (page_size <= 0 || (page_size & (page_size - 1)))
+                return false;
+            size_type shift = 0;
+            while ((size_type(1) << shift) < page_size)
+                ++shift;
+            if (is_tracking() && get_dirty_map()[0] != shift)
+                return false; // another page size
+            bump_epoch();
+
+            size_t pages = (size_t(head_type::m_total_size) + page_size - 1) >> shift;
+            size_t bytes = 3 * sizeof(size_type) + (pages + 7) / 8;
+            if (bytes != size_type(bytes))
+                return false; // too large
+
+            size_type old_pages = 0;
+            void *ptr;
+            auto before = stats_before();
+            if (is_tracking())
+            {
+                old_pages = get_dirty_map()[1];
+                if (old_pages >= pages)
+                    return true; // already covered (nothing counted yet)
+                ptr = realloc_(ptr_from_offset(head_type::m_dirty), size_type(bytes));
+            }
+            else
+            {
+                ptr = aligned_malloc_(size_type(bytes), size_type(sizeof(size_type)));
+            }
+            count_system(before);
+            if (!ptr)
+                return false; // out of memory
+
+            head_type::m_dirty = offset_from_ptr(ptr);
+            auto map = get_dirty_map();
+            auto bits = reinterpret_cast<uint8_t *>(map + 3);
+            if (!old_pages)
+            {
+                map[0] = shift;
+                map[2] = 0;
+                std::memset(bits, 0, (pages + 7) / 8);
+            }
+            else // the new pages were out of the map
+            {
+                dirty_table(head_type::m_total_size);
+                std::memset(bits + (old_pages + 7) / 8, 0xFF, (pages + 7) / 8 - (old_pages + 7) / 8);
+                bits[old_pages / 8] |= uint8_t(0xFF << (old_pages % 8));
+            }
+            map[1] = size_type(pages);
+            dirty_range(head_type::m_dirty, size_type(bytes));
+            return true;
+        }
+        void untrack_dirty()
+        {
+            if (!is_tracking())
+                return;
+            auto ptr = ptr_from_offset(head_type::m_dirty);
+            head_type::m_dirty = 0;
+            auto before = stats_before();
+            free_(ptr);
+            count_system(before);
+        }
+
+        // forget the changes; a delta or a snapshot has been taken
+        void clear_dirty()
+        {
+            if (!is_tracking())
+                return;
+            auto map = get_dirty_map();
+            map[2] = 0;
+            std::memset(map + 3, 0, (size_t(map[1]) + 7) / 8);
+        }
+        bool is_dirty_page(size_t page) const
+        {
+            auto map = get_dirty_map();
+            if (page >= map[1])
+                return true;
+            return (reinterpret_cast<const uint8_t *>(map + 3)[page / 8] >> (page % 8)) & 1;
+        }
+        size_type dirty_table_end() const
+        {
+            auto end = get_dirty_map()[2];
+            return (end < head_type::m_total_size) ? end : head_type::m_total_size;
+        }
+
+        // mark the block (or the bytes) that you have written to
+        void touch(const void *ptr)
+        {
+            auto entry = fetch_entry(const_cast<void *>(ptr));
+            if (entry)
+                dirty_range(entry->m_offset, entry->m_data_size);
+        }
+        void touch(const void *ptr, size_t siz)
+        {
+            dirty_range(offset_from_ptr(ptr), siz);
+        }
+
+        void dirty_range(size_type offset, size_t siz)
+        {
+            if (!is_tracking() || siz <= 0)
+                return;
+            auto map = get_dirty_map();
+            auto bits = reinterpret_cast<uint8_t *>(map + 3);
+            size_t last = (offset + siz - 1) >> map[0];
+            if (last >= map[1])
+                last = size_t(map[1]) - 1;
+            for (size_t page = offset >> map[0]; page <= last; ++page)
+            {
+                bits[page / 8] |= uint8_t(1 << (page % 8));
+            }
+        }
+        // the table has changed below the end offset
+        void dirty_table(size_type end)
+        {
+            if (is_tracking() && get_dirty_map()[2] < end)
+                get_dirty_map()[2] = end;
+        }
+        void dirty_entry(size_type index)
+        {
+            dirty_table(size_type(head_type::m_boudary_2 + (size_t(index) + 1) * entry_size()));
+        }
+        void dirty_handle(handle_type h)
+        {
+            dirty_range(head_type::m_handles, 2 * sizeof(size_type));
+            dirty_range(size_type(head_type::m_handles + 2 * h * sizeof(size_type)), 2 * sizeof(size_type));
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // statistics
+        //
+        // The stats block is a system block that holds an EAT::STATS. The
+        // live counters follow every operation, and are counted again after
+        // release and CONCURRENT::detach. auto_compact compacts when the dead
+        // bytes reach the policy. It moves the blocks, so call it where no
+        // pointer into the image is held; the handles are kept.
+
+        bool has_stats() const
+        {
+#ifdef EAT_NO_STATS
+            return false;
+#else
+            return head_type::m_stats != 0;
+#endif
+        }
+        STATS *get_stats()
+        {
+            return reinterpret_cast<STATS *>(ptr_from_offset(head_type::m_stats));
+        }
+        const STATS *get_stats() const
+        {
+            return reinterpret_cast<const STATS *>(ptr_from_offset(head_type::m_stats));
+        }
+
+        // start counting. fails if out of memory or EAT_NO_STATS is defined.
+        bool enable_stats()
+        {
+            assert(is_valid());
+#ifdef EAT_NO_STATS
+            return false;
+#else
+            if (has_stats())
+                return true;
+            bump_epoch();
+            void *ptr = aligned_malloc_(size_type(sizeof(STATS)), size_type(sizeof(uint64_t)));
+            if (!ptr)
+                return false; // out of memory
+            std::memset(ptr, 0, sizeof(STATS));
+            head_type::m_stats = offset_from_ptr(ptr);
+            recount_stats();
+            return true;
+#endif
+        }
+        void disable_stats()
+        {
+            if (!head_type::m_stats)
+                return;
+            auto ptr = ptr_from_offset(head_type::m_stats);
+            head_type::m_stats = 0;
+            free_(ptr);
+        }
+        // zero the counters of the events. the live counters and the policy
+        // are kept.
+        void reset_stats()
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            STATS kept = *stats;
+            std::memset(stats, 0, sizeof(STATS));
+            stats->m_live_bytes = kept.m_live_bytes;
+            stats->m_live_entries = kept.m_live_entries;
+            stats->m_compact_percent = kept.m_compact_percent;
+            stats->m_compact_min = kept.m_compact_min;
+            stats->m_peak_used = used_area_size();
+        }
+        void recount_stats()
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            stats->m_live_bytes = stats->m_live_entries = 0;
+            count_live(stats->m_live_bytes, stats->m_live_entries);
+            count_peak(stats);
+        }
+
+        // add the sizes and the number of the live blocks by a scan
+        void count_live(uint64_t& bytes, uint64_t& count) const
+        {
+            auto entries = get_entries();
+            auto num = num_entries();
+            for (auto i = next_entry(0); i < num; i = next_entry(size_type(i + 1)))
+            {
+                bytes += entries[i].m_data_size;
+                ++count;
+            }
+        }
+
+        // the live and the dead bytes of the data area and entries of the
+        // table. they scan the table if the stats are not enabled.
+        size_type live_bytes() const
+        {
+            uint64_t bytes = 0, count = 0;
+            if (has_stats())
+                bytes = get_stats()->m_live_bytes;
+            else
+                count_live(bytes, count);
+            return size_type(bytes);
+        }
+        size_type dead_bytes() const
+        {
+            return size_type(data_area_size() - live_bytes());
+        }
+        size_type live_entries() const
+        {
+            uint64_t bytes = 0, count = 0;
+            if (has_stats())
+                count = get_stats()->m_live_entries;
+            else
+                count_live(bytes, count);
+            return size_type(count);
+        }
+        size_type dead_entries() const
+        {
+            return size_type(num_entries() - live_entries());
+        }
+
+        // compact when the dead bytes reach percent % of the data area and
+        // min_bytes. zero percent disables it.
+        bool set_compact_policy(unsigned percent, size_t min_bytes = 0)
+        {
+            if (!has_stats())
+                return false;
+            get_stats()->m_compact_percent = percent;
+            get_stats()->m_compact_min = min_bytes;
+            return true;
+        }
+        bool should_compact() const
+        {
+            if (!has_stats() || !get_stats()->m_compact_percent)
+                return false;
+            auto stats = get_stats();
+            uint64_t dead = dead_bytes();
+            return dead > 0 && dead >= stats->m_compact_min &&
+                   dead * 100 >= stats->m_compact_percent * data_area_size();
+        }
+        // returns true if compacted
+        bool auto_compact()
+        {
+            if (!should_compact())
+                return false;
+            compact();
+            ++get_stats()->m_auto_compacts;
+            return true;
+        }
+
+        // count the events. they do nothing without the stats block.
+        void count_alloc(const void *ptr, size_t siz, size_t n = 1)
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            if (!ptr)
+            {
+                ++stats->m_failed;
+                return;
+            }
+            stats->m_allocs += n;
+            stats->m_live_bytes += siz;
+            stats->m_live_entries += n;
+            count_peak(stats);
+        }
+        void count_free(size_type siz)
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            ++stats->m_frees;
+            stats->m_live_bytes -= siz;
+            --stats->m_live_entries;
+        }
+        void count_realloc()
+        {
+            if (has_stats())
+                ++get_stats()->m_reallocs;
+        }
+        void count_resized(size_type old_size, size_type siz)
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            stats->m_live_bytes += uint64_t(siz) - old_size;
+            count_peak(stats);
+        }
+        void count_moved(size_t bytes)
+        {
+            if (has_stats())
+                get_stats()->m_moved += bytes;
+        }
+        void count_merged(const MASTER<T_SIZE>& src)
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            stats->m_live_bytes += src.live_bytes();
+            stats->m_live_entries += src.live_entries();
+            count_peak(stats);
+        }
+        // the calls for the system blocks are counted apart from the calls
+        // of the user: take the counts before them, and pass to count_system.
+        STATS stats_before() const
+        {
+            STATS before = STATS();
+            if (has_stats())
+                before = *get_stats();
+            return before;
+        }
+        void count_system(const STATS& before)
+        {
+            if (!has_stats())
+                return;
+            auto stats = get_stats();
+            stats->m_system_allocs += stats->m_allocs - before.m_allocs;
+            stats->m_system_frees += stats->m_frees - before.m_frees;
+            stats->m_allocs = before.m_allocs;
+            stats->m_frees = before.m_frees;
+            stats->m_reallocs = before.m_reallocs;
+            stats->m_failed = before.m_failed;
+        }
+        void count_peak(STATS *stats)
+        {
+            if (stats->m_peak_used < used_area_size())
+                stats->m_peak_used = used_area_size();
+        }
+
+        // free the copies of the system blocks of the merged source
+        void free_system_copies(const MASTER<T_SIZE>& src, size_type diff)
+        {
+            auto before = stats_before();
+            if (src.head_type::m_dirty)
+                free_(ptr_from_offset(size_type(src.head_type::m_dirty + diff)));
+            if (src.head_type::m_stats)
+                free_(ptr_from_offset(size_type(src.head_type::m_stats + diff)));
+            if (src.head_type::m_names)
+                free_(ptr_from_offset(size_type(src.head_type::m_names + diff)));
+            if (src.head_type::m_slabs)
+                free_(ptr_from_offset(size_type(src.head_type::m_slabs + diff)));
+            count_system(before);
+        }
+
+        // callback: bool T_ENTRY_FN(entry_type&);
+        template <typename T_ENTRY_FN>
+        void foreach_entry(T_ENTRY_FN& fn)
+        {
+            assert(is_valid());
+            auto entries = get_entries();
+            for (auto i = next_entry(0); i < num_entries(); i = next_entry(size_type(i + 1)))
+            {
+                if (!fn(entries[i]))
+                    break;
+            }
+            assert(is_valid());
+        }
+
+        // callback: bool T_PTR_FN(void *);
+        template <typename T_PTR_FN>
+        void foreach_ptr(T_PTR_FN& fn)
+        {
+            assert(is_valid());
+            auto entries = get_entries();
+            for (auto i = next_entry(0); i < num_entries(); i = next_entry(size_type(i + 1)))
+            {
+                void *ptr = ptr_from_offset(entries[i].m_offset);
+                if (!fn(ptr))
+                    break;
+            }
+            assert(is_valid());
+        }
+    }; // EAT::MASTER<T_SIZE>
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::SCOPE<T_SIZE> --- releases the blocks allocated in the scope
+
+    template <typename T_SIZE>
+    struct SCOPE
+    {
+        typedef MASTER<T_SIZE>    master_type;
+
+        SCOPE(master_type *master) : m_master(master), m_mark(master->mark()), m_active(true)
+        {
+        }
+        ~SCOPE()
+        {
+            release();
+        }
+
+        // returns false if the blocks cannot be released (they are kept)
+        bool release()
+        {
+            if (!m_active)
+                return true;
+            m_active = false;
+            return m_master->release(m_mark);
+        }
+
+    protected:
+        master_type *m_master;
+        typename master_type::MARK m_mark;
+        bool m_active;
+
+        // not copyable
+        SCOPE(const SCOPE&);
+        SCOPE& operator=(const SCOPE&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////////
+    // EAT::create_master<T_SIZE>(total_size)
+    // EAT::resize_master<T_SIZE>(old_master, new_total_size)
+    // EAT::grown_size<T_SIZE>(master, required, limit)
+    // EAT::widen_master<T_NEW>(old_master, new_total_size = 0, pdiff = NULL)
+    // EAT::master_from_image<T_SIZE>(image_ptr, image_size = 0)
+    // EAT::destroy_master
+
+    namespace detail
     {
-        if (new_total_size < old_master->size() &&
-            old_master->free_area_size() < old_master.size() - new_total_size)
+        // the heap storage of an image at an address aligned to align.
+        // up to alignof(max_align_t), it is plain std::malloc storage.
+        inline void *alloc_image(size_t size, size_t align = 1)
+        {
+#ifdef _WIN32
+            return _aligned_malloc(size, std::max(align, alignof(std::max_align_t)));
+#else
+            if (align <= alignof(std::max_align_t))
+                return std::malloc(size);
+            void *ptr;
+            if (posix_memalign(&ptr, align, size) != 0)
+                return NULL;
+            return ptr;
+#endif
+        }
+        inline void free_image(void *ptr)
+        {
+#ifdef _WIN32
+            _aligned_free(ptr);
+#else
+            std::free(ptr);
+#endif
+        }
+        // move the image to new storage of an aligned address
+        inline void *move_image(void *ptr, size_t old_size, size_t new_size, size_t align)
+        {
+            void *new_ptr = alloc_image(new_size, align);
+            if (!new_ptr)
+                return NULL;
+            std::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+            free_image(ptr);
+            return new_ptr;
+        }
+        // resize the storage. up to alignof(max_align_t), std::realloc may
+        // keep the image in place; beyond it, the image is copied.
+        // returns NULL and keeps the old image if failed.
+        inline void *realloc_image(void *ptr, size_t old_size, size_t new_size, size_t align)
+        {
+#ifndef _WIN32
+            if (align <= alignof(std::max_align_t))
+                return std::realloc(ptr, new_size);
+#endif
+            return move_image(ptr, old_size, new_size, align);
+        }
+        // move the image if it is not aligned
+        inline void *align_image(void *ptr, size_t size, size_t align)
         {
+            if (is_aligned_ptr(ptr, align))
+                return ptr;
+            return move_image(ptr, size, size, align);
+        }
+    } // namespace detail
+
+    // the image is placed at an address aligned to align, for the blocks
+    // of aligned_malloc_ or merge beyond alignof(std::max_align_t)
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *create_master(size_t total_size, size_t align = 1)
+    {
+        if (total_size != size_t(T_SIZE(total_size)))
+            return NULL; // too large
+        auto master = reinterpret_cast<MASTER<T_SIZE> *>(detail::alloc_image(total_size, align));
+        if (!master)
             return NULL;
+        master->init(total_size);
+        return master;
+    }
+
+    inline void destroy_master(void *master)
+    {
+        detail::free_image(master);
+    }
+
+    // the new image keeps image_alignment(), and is aligned to align as well
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *resize_master(MASTER<T_SIZE> *old_master, size_t new_total_size,
+                                         size_t align = 1)
+    {
+        if (new_total_size != T_SIZE(new_total_size))
+            return NULL; // too large
+        align = std::max(align, size_t(old_master->image_alignment()));
+        if (new_total_size < old_master->size()) // shrink?
+        {
+            // move the table before cutting the tail
+            if (!old_master->resize(T_SIZE(new_total_size)))
+                return NULL;
+            auto new_ptr = detail::realloc_image(old_master, new_total_size, new_total_size, align);
+            if (!new_ptr)
+                return old_master; // still usable
+            return reinterpret_cast<MASTER<T_SIZE> *>(new_ptr);
         }
-        auto new_ptr = std::realloc(old_master, new_total_size);
+        auto new_ptr = detail::realloc_image(old_master, old_master->total_size(), new_total_size, align);
         if (!new_ptr)
             return NULL;
         auto new_master = reinterpret_cast<MASTER<T_SIZE> *>(new_ptr);
-        new_master->resize(new_total_size);
+        new_master->resize(T_SIZE(new_total_size));
+        return new_master;
+    }
+
+    // the geometric growth policy: the new total size for the required
+    // free area, at least doubled and within the limit
+    template <typename T_SIZE>
+    inline size_t grown_size(const MASTER<T_SIZE> *master, size_t required, size_t limit)
+    {
+        size_t total = master->total_size(), free_size = master->free_area_size();
+        if (required <= free_size)
+            return total;
+        size_t minimum = total + (required - free_size);
+        size_t size = (total * 2 > minimum) ? total * 2 : minimum;
+        if (size > limit)
+            size = limit;
+        if (size > size_t(T_SIZE(-1)))
+            size = T_SIZE(-1);
+        return (size >= minimum) ? size : 0; // zero if impossible
+    }
+
+    // grow the master once for merge_many of the sources, within the limit.
+    // returns the master (which may move), or NULL if failed.
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *grow_for_merge(MASTER<T_SIZE> *master, const MASTER<T_SIZE> *const *srcs,
+                                          size_t n, size_t limit = size_t(T_SIZE(-1)))
+    {
+        auto room = master->merge_room(srcs, n);
+        size_t align = 1;
+        for (size_t k = 0; k < n; ++k)
+        {
+            align = std::max(align, size_t(srcs[k]->address_alignment()));
+        }
+        if (room <= master->free_area_size() && detail::is_aligned_ptr(master, align))
+            return master;
+        if (room == size_t(-1))
+            return NULL; // not mergeable
+        auto new_total_size = grown_size(master, room, limit);
+        if (!new_total_size)
+            return NULL; // too large
+        return resize_master(master, new_total_size, align);
+    }
+
+    // the master of the wider size type with the blocks of the old master,
+    // which is destroyed if succeeded. see MASTER::widen. by default, the
+    // free area is kept.
+    template <typename T_NEW, typename T_SIZE>
+    inline MASTER<T_NEW> *widen_master(MASTER<T_SIZE> *old_master, size_t new_total_size = 0,
+                                       T_NEW *pdiff = NULL)
+    {
+        if (!new_total_size)
+            new_total_size = MASTER<T_NEW>::widened_size(*old_master) + old_master->free_area_size();
+        auto new_master = create_master<T_NEW>(new_total_size, old_master->image_alignment());
+        if (!new_master)
+            return NULL;
+        if (!new_master->widen(*old_master, pdiff))
+        {
+            destroy_master(new_master);
+            return NULL;
+        }
+        destroy_master(old_master);
         return new_master;
     }
 
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::AUTO_MASTER --- a master that grows and widens on demand
+    //
+    // NOTE: It starts with the narrowest size type for the total size, so
+    //       a small image keeps the small entries. When the master is full,
+    //       it grows by resize_master, and then widens to uint32_t and
+    //       uint64_t by widen_master. Growing may move the blocks; keep the
+    //       handles, not the pointers. The offsets shift when it widens.
+
+    struct AUTO_MASTER
+    {
+        AUTO_MASTER(size_t total_size = 1024, size_t limit = size_t(-1))
+            : m_master16(NULL), m_master32(NULL), m_master64(NULL), m_limit(limit)
+        {
+            if (total_size == size_t(uint16_t(total_size)))
+                m_master16 = create_master<uint16_t>(total_size);
+            else if (total_size == size_t(uint32_t(total_size)))
+                m_master32 = create_master<uint32_t>(total_size);
+            else
+                m_master64 = create_master<uint64_t>(total_size);
+        }
+        ~AUTO_MASTER()
+        {
+            destroy_master(m_master16);
+            destroy_master(m_master32);
+            destroy_master(m_master64);
+        }
+
+        bool is_valid() const
+        {
+            return m_master16 || m_master32 || m_master64;
+        }
+        // 2, 4 or 8
+        int size_type_size() const
+        {
+            return m_master16 ? 2 : (m_master32 ? 4 : 8);
+        }
+        // the master of the current size type, or NULL
+        MASTER<uint16_t> *master16()
+        {
+            return m_master16;
+        }
+        MASTER<uint32_t> *master32()
+        {
+            return m_master32;
+        }
+        MASTER<uint64_t> *master64()
+        {
+            return m_master64;
+        }
+        size_t total_size() const
+        {
+            if (m_master16)
+                return m_master16->total_size();
+            if (m_master32)
+                return m_master32->total_size();
+            return m_master64 ? size_t(m_master64->total_size()) : 0;
+        }
+
+        void *malloc_(size_t siz)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                void *ptr = NULL;
+                if (m_master16)
+                    ptr = malloc_in(m_master16, siz);
+                else if (m_master32)
+                    ptr = malloc_in(m_master32, siz);
+                else if (m_master64)
+                    ptr = malloc_in(m_master64, siz);
+                if (ptr || !reserve(siz + 64))
+                    return ptr;
+            }
+            return NULL;
+        }
+        void free_(void *ptr)
+        {
+            if (m_master16)
+                m_master16->free_(ptr);
+            else if (m_master32)
+                m_master32->free_(ptr);
+            else if (m_master64)
+                m_master64->free_(ptr);
+        }
+
+        // the handles are kept when it grows or widens
+        uint64_t alloc_handle(size_t siz)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                uint64_t h = 0;
+                size_t table = 0;
+                if (m_master16)
+                    h = alloc_handle_in(m_master16, siz, table);
+                else if (m_master32)
+                    h = alloc_handle_in(m_master32, siz, table);
+                else if (m_master64)
+                    h = alloc_handle_in(m_master64, siz, table);
+                if (h || !reserve(siz + 64 + table))
+                    return h;
+            }
+            return 0;
+        }
+        void *deref(uint64_t h)
+        {
+            if (m_master16)
+                return m_master16->deref(uint16_t(h));
+            if (m_master32)
+                return m_master32->deref(uint32_t(h));
+            return m_master64 ? m_master64->deref(h) : NULL;
+        }
+        void free_handle(uint64_t h)
+        {
+            if (m_master16)
+                m_master16->free_handle(uint16_t(h));
+            else if (m_master32)
+                m_master32->free_handle(uint32_t(h));
+            else if (m_master64)
+                m_master64->free_handle(h);
+        }
+
+        // make the free area at least required bytes
+        bool reserve(size_t required)
+        {
+            if (m_master16)
+                return grow(m_master16, required) || widen(m_master16, m_master32, required);
+            if (m_master32)
+                return grow(m_master32, required) || widen(m_master32, m_master64, required);
+            return m_master64 && grow(m_master64, required);
+        }
+
+    protected:
+        MASTER<uint16_t> *m_master16;       // one of them is used
+        MASTER<uint32_t> *m_master32;
+        MASTER<uint64_t> *m_master64;
+        size_t m_limit;
+
+        template <typename T_SIZE>
+        static void *malloc_in(MASTER<T_SIZE> *master, size_t siz)
+        {
+            if (siz != size_t(T_SIZE(siz)))
+                return NULL; // too large
+            return master->malloc_(T_SIZE(siz));
+        }
+        template <typename T_SIZE>
+        static uint64_t alloc_handle_in(MASTER<T_SIZE> *master, size_t siz, size_t& table)
+        {
+            // the table may double
+            table = (size_t(master->handle_capacity()) * 4 + 2) * sizeof(T_SIZE);
+            if (siz != size_t(T_SIZE(siz)))
+                return 0; // too large
+            return master->alloc_handle(T_SIZE(siz));
+        }
+
+        template <typename T_SIZE>
+        bool grow(MASTER<T_SIZE> *& master, size_t required)
+        {
+            auto new_total_size = grown_size(master, required, m_limit);
+            if (!new_total_size)
+                return false; // too large
+            if (new_total_size == master->total_size())
+                return true;
+            auto new_master = resize_master(master, new_total_size);
+            if (!new_master)
+                return false; // out of memory
+            master = new_master;
+            return true;
+        }
+        template <typename T_SIZE, typename T_NEW>
+        bool widen(MASTER<T_SIZE> *& master, MASTER<T_NEW> *& new_master, size_t required)
+        {
+            if (m_limit <= size_t(T_SIZE(-1)))
+                return false; // no use
+            size_t total = size_t(master->total_size()) * 2;
+            if (total < MASTER<T_NEW>::widened_size(*master) + required)
+                total = MASTER<T_NEW>::widened_size(*master) + required;
+            if (total > m_limit)
+                total = m_limit;
+            new_master = widen_master<T_NEW>(master, total);
+            if (!new_master)
+                return false; // out of memory, or too large
+            master = NULL;
+            return true;
+        }
+
+        // not copyable
+        AUTO_MASTER(const AUTO_MASTER&);
+        AUTO_MASTER& operator=(const AUTO_MASTER&);
+    };
+
+    // NOTE: A valid image is used as it is (an older one is upgraded).
+    //       Otherwise, the image is initialized if image_size is non-zero.
+    //       The blocks are aligned only as far as image_ptr is aligned.
     template <typename T_SIZE>
     inline MASTER<T_SIZE> *master_from_image(void *image_ptr, size_t image_size = 0)
     {
         auto master = reinterpret_cast<MASTER<T_SIZE> *>(image_ptr);
         if (!master)
             return NULL;
-        if (image_size)
-            master->init(image_size);
-        else
-            master->init(master->total_size());
+        if (master->upgrade())
+        {
+            if (image_size && image_size < master->total_size())
+                return NULL; // truncated
+            return master;
+        }
+        if (!image_size)
+            return NULL; // not an image
+        master->init(image_size);
+        return master;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::write_master<T_SIZE>(master, write_fn, compact = false)
+    // EAT::read_master<T_SIZE>(read_fn)
+    // EAT::save_master<T_SIZE>(master, fp_or_path, compact = false)
+    // EAT::load_master<T_SIZE>(fp_or_path)
+    //
+    // NOTE: A snapshot is the header, the data area and the table from the
+    //       bottom entry, without the free area, which is zero-filled on load.
+    //       The callbacks are bool write_fn(const void *, size_t) and
+    //       bool read_fn(void *, size_t). Writing uses a fixed-size buffer.
+    //       The compact mode drops the holes and the unused bytes on the fly
+    //       like compact(), needing a copy of the handle table only.
+
+    namespace detail
+    {
+        // write through a fixed-size buffer
+        template <typename T_WRITE_FN>
+        struct SNAPSHOT_WRITER
+        {
+            T_WRITE_FN& m_fn;
+            size_t m_used;
+            bool m_ok;
+            char m_buffer[4096];
+
+            SNAPSHOT_WRITER(T_WRITE_FN& fn) : m_fn(fn), m_used(0), m_ok(true)
+            {
+            }
+
+            void write(const void *ptr, size_t size)
+            {
+                if (m_used + size > sizeof(m_buffer))
+                    flush();
+                if (size >= sizeof(m_buffer)) // write directly
+                {
+                    m_ok = m_ok && m_fn(ptr, size);
+                    return;
+                }
+                std::memcpy(m_buffer + m_used, ptr, size);
+                m_used += size;
+            }
+            void fill_zero(size_t size)
+            {
+                while (size > 0)
+                {
+                    if (m_used == sizeof(m_buffer))
+                        flush();
+                    auto count = std::min(size, sizeof(m_buffer) - m_used);
+                    std::memset(m_buffer + m_used, 0, count);
+                    m_used += count;
+                    size -= count;
+                }
+            }
+            bool flush()
+            {
+                if (m_used)
+                    m_ok = m_ok && m_fn(m_buffer, m_used);
+                m_used = 0;
+                return m_ok;
+            }
+        };
+    } // namespace detail
+
+    template <typename T_SIZE, typename T_WRITE_FN>
+    inline bool write_master(const MASTER<T_SIZE> *master, T_WRITE_FN& write_fn, bool compact = false)
+    {
+        typedef MASTER<T_SIZE> master_type;
+        typedef typename master_type::entry_type entry_type;
+        assert(master->is_valid());
+
+        HEAD<T_SIZE> head;
+        std::memcpy(&head, master, sizeof(head));
+        detail::SNAPSHOT_WRITER<T_WRITE_FN> writer(write_fn);
+        auto entries = master->get_entries();
+        auto num = master->num_entries();
+
+        if (!compact) // as it is
+        {
+            writer.write(&head, sizeof(head));
+            writer.write(master->get_data_area(), master->data_area_size());
+            for (auto i = num; i-- > 0; )
+            {
+                writer.write(&entries[i], sizeof(entry_type));
+            }
+            return writer.flush();
+        }
+
+        // compute the new handle table by the order of the offsets
+        auto capacity = master->handle_capacity();
+        T_SIZE *table = NULL, *order = NULL;
+        size_t live = 0;
+        if (capacity)
+        {
+            auto old_table = master->get_handle_table();
+            size_t table_bytes = (size_t(capacity) * 2 + 2) * sizeof(T_SIZE);
+            table = reinterpret_cast<T_SIZE *>(std::malloc(table_bytes));
+            order = reinterpret_cast<T_SIZE *>(std::malloc(capacity * sizeof(T_SIZE)));
+            if (!table || !order)
+            {
+                std::free(table);
+                std::free(order);
+                return false; // out of memory
+            }
+            std::memcpy(table, old_table, table_bytes);
+            for (T_SIZE h = 1; h <= capacity; ++h)
+            {
+                if (old_table[2 * h])
+                    order[live++] = h;
+            }
+            std::sort(order, order + live, [old_table](T_SIZE a, T_SIZE b) {
+                return old_table[2 * a] < old_table[2 * b];
+            });
+        }
+
+        // lay out the valid blocks from the bottom
+        size_t cursor = master->head_size(), count = 0, k = 0;
+        for (auto i = master->prev_entry(num); i < num; i = master->prev_entry(i))
+        {
+            auto& entry = entries[i];
+            auto offset = master_type::align_up(T_SIZE(cursor), entry.alignment());
+            if (entry.m_offset == head.m_handles)
+                head.m_handles = offset;
+            if (entry.m_offset == head.m_dirty)
+                head.m_dirty = offset;
+            if (entry.m_offset == head.m_stats)
+                head.m_stats = offset;
+            if (entry.m_offset == head.m_names)
+                head.m_names = offset;
+            if (entry.m_offset == head.m_slabs)
+                head.m_slabs = offset;
+            for (; k < live && table[2 * order[k]] <= entry.m_offset; ++k)
+            {
+                if (table[2 * order[k]] == entry.m_offset)
+                    table[2 * order[k]] = offset;
+            }
+            cursor = offset + entry.m_data_size;
+            ++count;
+        }
+        head.m_boudary_1 = T_SIZE(cursor);
+        head.m_boudary_2 = T_SIZE(master->total_size() - count * sizeof(entry_type));
+        head.m_compacted = head.m_boudary_1;
+        ++head.m_epoch; // the marks are no longer valid
+        head.m_mark = 0;
+        writer.write(&head, sizeof(head));
+
+        // write the data and then the entries
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            cursor = master->head_size();
+            for (auto i = master->prev_entry(num); i < num; i = master->prev_entry(i))
+            {
+                auto entry = entries[i];
+                auto offset = master_type::align_up(T_SIZE(cursor), entry.alignment());
+                if (pass == 0)
+                {
+                    writer.fill_zero(offset - cursor);
+                    if (capacity && offset == head.m_handles)
+                        writer.write(table, entry.m_data_size); // the new handle table
+                    else
+                        writer.write(master->ptr_from_offset(entry.m_offset), entry.m_data_size);
+                }
+                else
+                {
+                    entry.m_offset = offset;
+                    writer.write(&entry, sizeof(entry));
+                }
+                cursor = offset + entry.m_data_size;
+            }
+        }
+
+        std::free(table);
+        std::free(order);
+        return writer.flush();
+    }
+
+    template <typename T_SIZE, typename T_READ_FN>
+    inline MASTER<T_SIZE> *read_master(T_READ_FN& read_fn)
+    {
+        typedef HEAD<T_SIZE> head_type;
+
+        // the header of version 3 is the shortest
+        head_type head;
+        std::memset(static_cast<void *>(&head), 0, sizeof(head));
+        size_t head_size = head_type::v3_head_size();
+        if (!read_fn(&head, head_size) || std::memcmp(head.m_magic, "EAT", 3) != 0 ||
+            head.size_type_size() != sizeof(T_SIZE) || head.version() > EYEBALL_ALLOCATION_TABLE)
+        {
+            return NULL; // not a snapshot
+        }
+        if (head.version() >= 4)
+        {
+            if (!read_fn(reinterpret_cast<char *>(&head) + head_size, sizeof(head) - head_size))
+                return NULL;
+            head_size = sizeof(head);
+        }
+
+        size_t entry_size = (head.version() >= 5) ? sizeof(ENTRY<T_SIZE>) : sizeof(ENTRY_V4<T_SIZE>);
+        size_t total = head.m_total_size, b1 = head.m_boudary_1, b2 = head.m_boudary_2;
+        if (!(head_size <= b1 && b1 <= b2 && b2 <= total && (total - b2) % entry_size == 0))
+            return NULL; // broken
+
+        auto image = reinterpret_cast<char *>(detail::alloc_image(total));
+        if (!image)
+            return NULL;
+        std::memcpy(image, &head, head_size);
+        std::memset(image + b1, 0, b2 - b1);
+        if (!read_fn(image + head_size, b1 - head_size) || !read_fn(image + b2, total - b2))
+        {
+            detail::free_image(image);
+            return NULL;
+        }
+
+        // the table was written from the bottom entry
+        char tmp[sizeof(ENTRY_V4<T_SIZE>)];
+        for (size_t i = b2, j = total - entry_size; i < j; i += entry_size, j -= entry_size)
+        {
+            std::memcpy(tmp, image + i, entry_size);
+            std::memcpy(image + i, image + j, entry_size);
+            std::memcpy(image + j, tmp, entry_size);
+        }
+
+        auto master = reinterpret_cast<MASTER<T_SIZE> *>(image);
+        if (!master->upgrade())
+        {
+            detail::free_image(image);
+            return NULL;
+        }
+        auto aligned = detail::align_image(image, total, master->image_alignment());
+        if (!aligned)
+            detail::free_image(image);
+        return reinterpret_cast<MASTER<T_SIZE> *>(aligned);
+    }
+
+    template <typename T_SIZE>
+    inline bool save_master(const MASTER<T_SIZE> *master, FILE *fp, bool compact = false)
+    {
+        auto write_fn = [fp](const void *ptr, size_t size) {
+            return std::fwrite(ptr, 1, size, fp) == size;
+        };
+        return write_master(master, write_fn, compact);
+    }
+    template <typename T_SIZE>
+    inline bool save_master(const MASTER<T_SIZE> *master, const char *path, bool compact = false)
+    {
+        FILE *fp = std::fopen(path, "wb");
+        if (!fp)
+            return false;
+        bool ok = save_master(master, fp, compact);
+        return (std::fclose(fp) == 0) && ok;
+    }
+
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *load_master(FILE *fp)
+    {
+        auto read_fn = [fp](void *ptr, size_t size) {
+            return std::fread(ptr, 1, size, fp) == size;
+        };
+        return read_master<T_SIZE>(read_fn);
+    }
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *load_master(const char *path)
+    {
+        FILE *fp = std::fopen(path, "rb");
+        if (!fp)
+            return NULL;
+        auto master = load_master<T_SIZE>(fp);
+        std::fclose(fp);
+        return master;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // EAT::write_delta<T_SIZE>(master, write_fn)
+    // EAT::read_delta<T_SIZE>(master, read_fn)
+    // EAT::save_delta<T_SIZE>(master, fp_or_path)
+    // EAT::apply_delta<T_SIZE>(master, fp_or_path)
+    //
+    // NOTE: A delta is the header and the ranges changed since the last
+    //       delta, as (offset, size, bytes) records ended by (0, 0). It needs
+    //       the dirty map (see track_dirty), and writing it clears the map.
+    //       A delta rolls the image forward from the snapshot (or the delta)
+    //       before it. Take the base snapshot as it is, not compacted, and
+    //       call clear_dirty() then.
+    //       Reading moves the image to new storage if the total size has
+    //       changed. If it fails, the image is broken and destroyed.
+    //       save_delta to a path appends to the file. apply_delta applies all
+    //       the deltas in the file, and none if there is no file.
+
+    template <typename T_SIZE, typename T_WRITE_FN>
+    inline bool write_delta(MASTER<T_SIZE> *master, T_WRITE_FN& write_fn)
+    {
+        assert(master->is_valid());
+        if (!master->is_tracking())
+            return false;
+        if (master->has_stats()) // the counters change without marking
+            master->touch(master->get_stats(), sizeof(STATS));
+
+        detail::SNAPSHOT_WRITER<T_WRITE_FN> writer(write_fn);
+        auto record = [master, &writer](size_t offset, size_t size) {
+            T_SIZE range[2] = { T_SIZE(offset), T_SIZE(size) };
+            writer.write(range, sizeof(range));
+            writer.write(master->ptr_from_offset(T_SIZE(offset)), size);
+        };
+        writer.write(master, master->head_size());
+
+        // the runs of the dirty pages in the data area
+        size_t head_size = master->head_size();
+        size_t b1 = head_size + master->data_area_size();
+        size_t shift = master->get_dirty_map()[0], start = 0;
+        bool in_run = false;
+        for (size_t page = head_size >> shift; (page << shift) < b1; ++page)
+        {
+            bool dirty = master->is_dirty_page(page);
+            if (dirty && !in_run)
+            {
+                start = std::max(page << shift, head_size);
+                in_run = true;
+            }
+            else if (!dirty && in_run)
+            {
+                record(start, (page << shift) - start);
+                in_run = false;
+            }
+        }
+        if (in_run)
+            record(start, b1 - start);
+
+        // the changed part of the table
+        size_t b2 = master->total_size() - master->table_size();
+        size_t end = master->dirty_table_end();
+        if (end > b2)
+            record(b2, end - b2);
+
+        T_SIZE terminator[2] = { 0, 0 };
+        writer.write(terminator, sizeof(terminator));
+        if (!writer.flush())
+            return false;
+        master->clear_dirty();
+        return true;
+    }
+
+    template <typename T_SIZE, typename T_READ_FN>
+    inline MASTER<T_SIZE> *read_delta(MASTER<T_SIZE> *master, T_READ_FN& read_fn)
+    {
+        HEAD<T_SIZE> head;
+        size_t head_size = sizeof(head), total = 0;
+        bool ok = read_fn(&head, head_size) && head.is_valid() && head.m_boudary_1 >= head_size &&
+                  (head.m_total_size - head.m_boudary_2) % sizeof(ENTRY<T_SIZE>) == 0;
+        if (ok && head.m_total_size != master->total_size())
+        {
+            auto new_ptr = detail::realloc_image(master, std::min(size_t(master->total_size()),
+                                                                  size_t(head.m_total_size)),
+                                                 head.m_total_size, master->image_alignment());
+            if (new_ptr)
+                master = reinterpret_cast<MASTER<T_SIZE> *>(new_ptr);
+            else
+                ok = false;
+        }
+        if (ok)
+            total = head.m_total_size;
+
+        auto image = reinterpret_cast<char *>(master);
+        while (ok)
+        {
+            T_SIZE range[2];
+            if (!read_fn(range, sizeof(range)))
+                ok = false;
+            else if (range[1] == 0)
+                break; // the end
+            else if (range[0] < head_size || range[1] > total || range[0] > total - range[1])
+                ok = false; // broken
+            else
+                ok = read_fn(image + range[0], range[1]);
+        }
+        if (ok)
+        {
+            std::memcpy(image, &head, head_size);
+            ok = master->is_intact();
+        }
+        if (ok) // the delta may have added stricter blocks
+        {
+            auto aligned = detail::align_image(master, total, master->image_alignment());
+            if (aligned)
+                master = reinterpret_cast<MASTER<T_SIZE> *>(aligned);
+            else
+                ok = false;
+        }
+        if (!ok)
+        {
+            destroy_master(master);
+            return NULL;
+        }
+        master->clear_dirty();
+        return master;
+    }
+
+    template <typename T_SIZE>
+    inline bool save_delta(MASTER<T_SIZE> *master, FILE *fp)
+    {
+        auto write_fn = [fp](const void *ptr, size_t size) {
+            return std::fwrite(ptr, 1, size, fp) == size;
+        };
+        return write_delta(master, write_fn);
+    }
+    template <typename T_SIZE>
+    inline bool save_delta(MASTER<T_SIZE> *master, const char *path)
+    {
+        FILE *fp = std::fopen(path, "ab");
+        if (!fp)
+            return false;
+        bool ok = save_delta(master, fp);
+        return (std::fclose(fp) == 0) && ok;
+    }
+
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *apply_delta(MASTER<T_SIZE> *master, FILE *fp)
+    {
+        auto read_fn = [fp](void *ptr, size_t size) {
+            return std::fread(ptr, 1, size, fp) == size;
+        };
+        int ch;
+        while (master && (ch = std::fgetc(fp)) != EOF)
+        {
+            std::ungetc(ch, fp);
+            master = read_delta(master, read_fn);
+        }
+        return master;
+    }
+    template <typename T_SIZE>
+    inline MASTER<T_SIZE> *apply_delta(MASTER<T_SIZE> *master, const char *path)
+    {
+        FILE *fp = std::fopen(path, "rb");
+        if (!fp)
+            return master; // no delta
+        master = apply_delta(master, fp);
+        std::fclose(fp);
         return master;
     }
 } // namespace EAT